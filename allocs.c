@@ -0,0 +1,87 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * allocs.so counts the heap allocations of the program it is preloaded
+ * into.  On SIGUSR2 it appends the count so far to the file $ALLOCS names;
+ * latency -A takes one before and one after a repeat of its key script. */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+extern void *__libc_memalign(size_t align, size_t n);
+
+static void init(void) __attribute__((constructor));
+static void report(int sig);
+
+static unsigned long count = 0;
+static const char *path;
+
+void *
+malloc(size_t n) {
+	__sync_fetch_and_add(&count, 1);
+	return __libc_malloc(n);
+}
+
+void *
+calloc(size_t n, size_t size) {
+	__sync_fetch_and_add(&count, 1);
+	return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t n) {
+	__sync_fetch_and_add(&count, 1);
+	return __libc_realloc(p, n);
+}
+
+int
+posix_memalign(void **p, size_t align, size_t n) {
+	__sync_fetch_and_add(&count, 1);
+	return (*p = __libc_memalign(align, n)) ? 0 : ENOMEM;
+}
+
+void *
+aligned_alloc(size_t align, size_t n) {
+	__sync_fetch_and_add(&count, 1);
+	return __libc_memalign(align, n);
+}
+
+void *
+memalign(size_t align, size_t n) {
+	__sync_fetch_and_add(&count, 1);
+	return __libc_memalign(align, n);
+}
+
+void
+init(void) {
+	struct sigaction sa;
+
+	if(!(path = getenv("ALLOCS")))
+		return;
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = report;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+/* only async-signal-safe calls from here on */
+void
+report(int sig) {
+	char buf[32];
+	unsigned long n = count;
+	int fd, i = sizeof buf;
+
+	buf[--i] = '\n';
+	do
+		buf[--i] = '0' + n % 10;
+	while((n /= 10));
+	if((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)) == -1)
+		return;
+	write(fd, buf + i, sizeof buf - i);
+	close(fd);
+}
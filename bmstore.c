@@ -0,0 +1,212 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * bmstore adds bookmarks to a store laid out as bookmarks.h describes, the
+ * title and url given, or title<TAB>url lines from stdin.  A title stored
+ * before is given the new url. */
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bookmarks.h"
+
+#define ALIGN(n) (((n) + 7) & ~(uint64_t)7)  /* of the index */
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define SLACK    4096  /* bytes superseded that never call for a rewrite */
+
+static void add(const char *title, const char *url);
+static void die(const char *s);
+static uint64_t hash(const char *s);
+static void put(int fd, const void *p, size_t len, uint64_t off);
+static size_t reclen(const char *t);
+static void store(const char *file);
+
+static char *recs = NULL;     /* the new records */
+static size_t recslen = 0, recssize = 0;
+static uint64_t *recoff = NULL; /* of each in recs */
+static size_t nrecs = 0, recoffsize = 0;
+
+int
+main(int argc, char *argv[]) {
+	char *line = NULL, *tab;
+	size_t cap = 0;
+	ssize_t k;
+
+	if(argc == 4)
+		add(argv[2], argv[3]);
+	else if(argc == 2)
+		while((k = getline(&line, &cap, stdin)) != -1) {
+			if(k > 0 && line[k - 1] == '\n')
+				line[--k] = '\0';
+			if(!(tab = strchr(line, '\t')))
+				continue;
+			*tab = '\0';
+			add(line, tab + 1);
+		}
+	else {
+		fputs("usage: bmstore file [title url]\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	store(argv[1]);
+	return EXIT_SUCCESS;
+}
+
+void
+add(const char *title, const char *url) {
+	size_t tl = strlen(title), ul = strlen(url);
+
+	if(tl == 0)
+		return;
+	if(recslen + tl + ul + 2 > recssize && !(recs = realloc(recs, recssize = 2 * (recslen + tl + ul + 2))))
+		die("realloc");
+	if(nrecs == recoffsize && !(recoff = realloc(recoff, (recoffsize = recoffsize ? 2 * recoffsize : 64) * sizeof *recoff)))
+		die("realloc");
+	recoff[nrecs++] = recslen;
+	memcpy(recs + recslen, title, tl + 1);
+	memcpy(recs + recslen + tl + 1, url, ul + 1);
+	recslen += tl + ul + 2;
+}
+
+void
+die(const char *s) {
+	perror(s);
+	exit(EXIT_FAILURE);
+}
+
+uint64_t
+hash(const char *s) {
+	uint64_t h = 14695981039346656037ULL;
+
+	for(; *s; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	return h;
+}
+
+void
+put(int fd, const void *p, size_t len, uint64_t off) {
+	ssize_t n;
+
+	for(; len > 0; p = (const char *)p + n, len -= n, off += n)
+		if((n = pwrite(fd, p, len, off)) == -1)
+			die("pwrite");
+}
+
+/* bytes of the record of title t */
+size_t
+reclen(const char *t) {
+	size_t n = strlen(t) + 1;
+
+	return n + strlen(t + n) + 1;
+}
+
+/* append the new records and the index of all live ones to file, or write
+ * the store afresh if what is superseded would outweigh them */
+void
+store(const char *file) {
+	BookmarkHeader h = { BOOKMARKS_MAGIC, BOOKMARKS_VERSION, 0, sizeof h, sizeof h };
+	const char *base = NULL, *t;
+	char tmp[PATH_MAX];
+	uint64_t *live, off, end, used = sizeof h;
+	size_t *table, size, i, j, n = 0;
+	struct stat st, now;
+	int fd, out;
+
+	/* one writer at a time, readers need no lock.  A writer may have put a
+	 * rewritten store in place while we waited. */
+	for(;;) {
+		if((fd = open(file, O_RDWR | O_CREAT, 0644)) == -1)
+			die(file);
+		if(flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1 || stat(file, &now) == -1)
+			die(file);
+		if(st.st_ino == now.st_ino && st.st_dev == now.st_dev)
+			break;
+		close(fd);
+	}
+	if(st.st_size > 0) {
+		if((base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+			die("mmap");
+		if((size_t)st.st_size >= sizeof h)
+			memcpy(&h, base, sizeof h);
+		if((size_t)st.st_size < sizeof h || h.magic != BOOKMARKS_MAGIC || h.version != BOOKMARKS_VERSION
+		|| h.size > (uint64_t)st.st_size || h.index < sizeof h || h.index % sizeof *live
+		|| h.index > h.size || h.count > (h.size - h.index) / sizeof *live) {
+			fprintf(stderr, "%s: not a bookmark store\n", file);
+			exit(EXIT_FAILURE);
+		}
+	}
+	end = ALIGN(h.size);
+
+	/* the last url given for a title wins, stored ones are superseded */
+	for(size = 64; size < 2 * (h.count + nrecs); size *= 2);
+	if(!(table = malloc(size * sizeof *table)) || !(live = malloc((h.count + nrecs + 1) * sizeof *live)))
+		die("malloc");
+	memset(table, 0xff, size * sizeof *table);
+	for(i = nrecs; i-- > 0;) {
+		t = recs + recoff[i];
+		for(j = hash(t) & (size - 1); table[j] != SIZE_MAX; j = (j + 1) & (size - 1))
+			if(!strcmp(recs + recoff[table[j]], t))
+				break;
+		if(table[j] == SIZE_MAX)
+			table[j] = i;
+		else
+			recoff[i] = UINT64_MAX;
+	}
+	for(i = 0; i < h.count; i++) {
+		off = BOOKMARK_OFFSETS(base, h)[i];
+		if(off < sizeof h || off >= h.index || !(t = memchr(base + off, '\0', h.index - off))
+		|| !memchr(t + 1, '\0', base + h.index - (t + 1))) {
+			fprintf(stderr, "%s: bad bookmark %zu\n", file, i);
+			exit(EXIT_FAILURE);
+		}
+		for(j = hash(base + off) & (size - 1); table[j] != SIZE_MAX; j = (j + 1) & (size - 1))
+			if(!strcmp(recs + recoff[table[j]], base + off))
+				break;
+		if(table[j] == SIZE_MAX) {
+			live[n++] = off;
+			used += reclen(base + off);
+		}
+	}
+	for(i = 0; i < nrecs; i++)
+		if(recoff[i] != UINT64_MAX) {
+			live[n++] = end + recoff[i];
+			used += reclen(recs + recoff[i]);
+		}
+	used += n * sizeof *live;
+	h.count = n;
+
+	if(ALIGN(end + recslen) + n * sizeof *live - used <= MAX(used, SLACK)) {
+		/* records, index, then the header that makes them count */
+		put(fd, recs, recslen, end);
+		h.index = ALIGN(end + recslen);
+		h.size = h.index + n * sizeof *live;
+		put(fd, live, n * sizeof *live, h.index);
+		if(fdatasync(fd) == -1)
+			die("fdatasync");
+		put(fd, &h, sizeof h, 0);
+	}
+	else {
+		/* copy the live records next to file and put the copy in its place */
+		snprintf(tmp, sizeof tmp, "%s.XXXXXX", file);
+		if((out = mkstemp(tmp)) == -1)
+			die(tmp);
+		for(off = sizeof h, i = 0; i < n; i++) {
+			t = live[i] < end ? base + live[i] : recs + (live[i] - end);
+			put(out, t, j = reclen(t), off);
+			live[i] = off;
+			off += j;
+		}
+		h.index = ALIGN(off);
+		h.size = h.index + n * sizeof *live;
+		put(out, live, n * sizeof *live, h.index);
+		put(out, &h, sizeof h, 0);
+		if(fchmod(out, st.st_mode & 07777) == -1 || fsync(out) == -1 || rename(tmp, file) == -1)
+			die(tmp);
+		close(out);
+	}
+	close(fd);
+}
@@ -0,0 +1,27 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Layout of the bookmark store dmenu -bookmarks maps and bmstore writes: a
+ * header, then records of a title and its url, each ended by a NUL, and the
+ * offsets of the titles of the live records, count of them, where index
+ * says.  Records are only appended: bmstore writes new records and a new
+ * index after everything before, then the header in place, so the records
+ * and index a header names never change under a reader.  The header itself
+ * does, a reader copies it once and goes by the copy.  Superseded records and
+ * indices stay until they take more room than the live ones, then the store
+ * is rewritten.  All integers are in host byte order. */
+
+#include <stdint.h>
+
+#define BOOKMARKS_MAGIC   0x6d626d64  /* "dmbm" */
+#define BOOKMARKS_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t count;  /* live bookmarks */
+	uint64_t index;  /* offset of their offsets */
+	uint64_t size;   /* bytes in use, superseded ones included */
+} BookmarkHeader;
+
+/* the index of the mapping at base, by a copy h of its header */
+#define BOOKMARK_OFFSETS(base, h) ((const uint64_t *)((const char *)(base) + (h).index))
@@ -0,0 +1,263 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * check runs libdmenu through cases that went wrong before and exits with
+ * failure if any still does; make check builds and runs it. */
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <regex.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "libdmenu.h"
+
+static void additems(Menu *m, size_t n, unsigned long *seed);
+static size_t collect(Menu *m, const char *s);
+static void compact(void);
+static void fail(const char *fmt, ...);
+static void faraway(void);
+static void learnfile(void);
+static void regexes(void);
+static void settled(void);
+static void stress(void);
+
+static int failed = 0;
+
+int
+main(void) {
+	compact();
+	faraway();
+	learnfile();
+	regexes();
+	settled();
+	stress();
+	if(!failed)
+		puts("check: all passed");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* n items of random lowercase words */
+void
+additems(Menu *m, size_t n, unsigned long *seed) {
+	char buf[32];
+	size_t i, len, k;
+
+	for(i = 0; i < n; i++) {
+		len = 4 + *seed % 16;
+		for(k = 0; k < len; k++) {
+			*seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+			buf[k] = 'a' + (*seed >> 33) % 26;
+		}
+		menuadd(m, buf, len, 0);
+	}
+}
+
+/* match s and wait for the whole result, return how many items matched */
+size_t
+collect(Menu *m, const char *s) {
+	size_t pos[2] = { 0, 0 };
+
+	if(!menumatch(m, s, 20, pos))
+		return 0;
+	while(menupending(m)) {
+		menuwait(m);
+		menucollect(m);
+	}
+	return menucount(m);
+}
+
+/* removing most items and compacting the menu keeps the others, their text
+ * and what matches them */
+void
+compact(void) {
+	Menu *m = initmenu(MenuSub, MenuFold, 0);
+	const char **text;
+	unsigned int *map;
+	unsigned long seed = 3;
+	size_t pos[2] = { 0, 0 }, i, n, live;
+
+	additems(m, 1 << 16, &seed);
+	if(!(text = malloc(menuitems(m) * sizeof *text)) || !(map = malloc(menuitems(m) * sizeof *map))) {
+		fail("compact: out of memory\n");
+		return;
+	}
+	for(i = 0; i < menuitems(m); i++)
+		text[i] = menuitem(m, i);
+	menumatch(m, "ab", 20, pos);
+	for(i = 0; i < menuitems(m); i++)
+		if(i % 3)
+			menuremove(m, i);
+	n = menuitems(m);
+	menucompact(m, map);
+	for(i = live = 0; i < n; i++)
+		if(i % 3 ? map[i] != UINT_MAX : map[i] != live++ || menuitem(m, map[i]) != text[i])
+			break;
+	if(i < n || menuitems(m) != live || menudead(m))
+		fail("compact: item %zu went astray\n", i);
+	for(i = live = 0; i < n; i += 3)
+		live += strstr(text[i], "ab") != NULL;
+	if(collect(m, "AB") != live)
+		fail("compact: %zu matches of AB, not %zu\n", menucount(m), live);
+	freemenu(m);
+	free(text);
+	free(map);
+}
+
+void
+fail(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	fputs("check: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	failed = 1;
+}
+
+/* items given by reference that lie far apart each open a segment of their
+ * own, which ran out after 4096 of them */
+void
+faraway(void) {
+	const size_t n = 8192, gap = 2 << 20;
+	Menu *m = initmenu(MenuSub, 0, 0);
+	char *base;
+	size_t i;
+
+	if((base = mmap(NULL, n * gap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+		fputs("check: no room to map far apart items, skipped\n", stderr);
+		return;
+	}
+	for(i = 0; i < n; i++) {
+		sprintf(base + i * gap, "far%zu", i);
+		menuaddref(m, base + i * gap, strlen(base + i * gap), 0);
+	}
+	for(i = 0; i < n; i++)
+		if(menuitem(m, i) != base + i * gap)
+			break;
+	if(i < n)
+		fail("faraway: item %zu is not where it was added\n", i);
+	if(collect(m, "far") != n)
+		fail("faraway: %zu matches of far, not %zu\n", menucount(m), n);
+	freemenu(m);
+	munmap(base, n * gap);
+}
+
+/* a file that is no learn file is not made one, an empty one is */
+void
+learnfile(void) {
+	const char text[] = "ls\nmake check\n";
+	char path[] = "/tmp/dmenucheckXXXXXX", buf[sizeof text];
+	Menu *m = initmenu(MenuSub, 0, 0);
+	FILE *f;
+	int fd;
+
+	if((fd = mkstemp(path)) == -1 || !(f = fdopen(fd, "w+"))) {
+		fail("learnfile: cannot make %s\n", path);
+		return;
+	}
+	fputs(text, f);
+	fflush(f);
+	if(menulearn(m, path) || errno != EINVAL)
+		fail("learnfile: a text file was taken for a learn file\n");
+	rewind(f);
+	if(fread(buf, 1, sizeof buf, f) != sizeof text - 1 || memcmp(buf, text, sizeof text - 1))
+		fail("learnfile: a text file was changed\n");
+	freemenu(m);
+	m = initmenu(MenuSub, 0, 0);
+	if(ftruncate(fd, 0) == -1 || !menulearn(m, path))
+		fail("learnfile: an empty file was not made a learn file\n");
+	freemenu(m);
+	m = initmenu(MenuSub, 0, 0);
+	if(!menulearn(m, path))
+		fail("learnfile: a learn file was refused\n");
+	freemenu(m);
+	fclose(f);
+	unlink(path);
+}
+
+/* the literal a regular expression is prefiltered by must be one all its
+ * matches contain, stacked quantifiers made it demand too much */
+void
+regexes(void) {
+	static const char *pats[] = {
+		"x+?", "c+*", "1++?a+", "}+?", "ab+", "ab*c", "a{0,2}b", "xa{2}",
+		"(ab)+c", "a\\.?b", "b{,1}c", "a+{0}1", "ca|b", "[ab]x+"
+	};
+	const char *alpha = "abcx1}.";
+	Menu *m = initmenu(MenuRegex, 0, 0);
+	char buf[16];
+	unsigned long seed = 7;
+	size_t i, k, len, n, got;
+	regex_t re;
+
+	for(i = 0; i < 3000; i++) {
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		for(len = (seed >> 40) % 9, k = 0; k < len; k++) {
+			seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+			buf[k] = alpha[(seed >> 33) % 7];
+		}
+		menuadd(m, buf, len, 0);
+	}
+	for(k = 0; k < sizeof pats / sizeof *pats; k++) {
+		if(regcomp(&re, pats[k], REG_EXTENDED | REG_NOSUB))
+			continue;
+		for(n = i = 0; i < menuitems(m); i++)
+			n += !regexec(&re, menuitem(m, i), 0, NULL, 0);
+		regfree(&re);
+		if((got = collect(m, pats[k])) != n)
+			fail("regex %s: %zu matches, not %zu\n", pats[k], got, n);
+	}
+	freemenu(m);
+}
+
+/* a result from the cache is settled as a whole, not as far as the one
+ * before it was */
+void
+settled(void) {
+	Menu *m = initmenu(MenuSub, 0, 0);
+	unsigned long seed = 5;
+	size_t pos[2] = { 0, 0 };
+
+	additems(m, 1 << 12, &seed);
+	collect(m, "ab");
+	collect(m, "a");
+	menumatch(m, "ab", 20, pos);
+	if(menusettled(m) != menucount(m))
+		fail("settled: %zu of %zu cached matches settled\n", menusettled(m), menucount(m));
+	freemenu(m);
+}
+
+/* add items the moment the worker says it is idle, as dmenu does when it
+ * wakes up to its news, which grows the item arrays under a scan that has
+ * not let go of them yet */
+void
+stress(void) {
+	Menu *m = initmenu(MenuSub, 0, 0);
+	struct pollfd p;
+	unsigned long seed = 1;
+	size_t pos[2], i, k, n;
+
+	additems(m, 1 << 18, &seed);
+	for(k = 0; k < 16; k++) {
+		pos[0] = pos[1] = 0;
+		menumatch(m, k % 2 ? "ab" : "q", 20, pos);
+		while(menupending(m) || menubusy(m)) {
+			p.fd = menufd(m);
+			p.events = POLLIN;
+			poll(&p, 1, -1);
+			menucollect(m);
+			if(!menubusy(m)) {
+				additems(m, 1 + seed % 4096, &seed);
+				menuupdate(m);
+			}
+		}
+	}
+	for(n = i = 0; i < menuitems(m); i++)
+		n += strstr(menuitem(m, i), "ab") != NULL;
+	if(collect(m, "ab") != n)
+		fail("stress: %zu matches of ab, not %zu\n", menucount(m), n);
+	freemenu(m);
+}
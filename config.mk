@@ -14,16 +14,29 @@ X11LIB = /usr/lib/X11
 # XINERAMALIBS  = -lXinerama
 # XINERAMAFLAGS = -DXINERAMA
 
+# MIT-SHM client side rendering (-shm), comment if you don't want it
+SHMLIBS = -lXext
+SHMFLAGS = -DXSHM
+
+# live updates of -watch files with inotify, comment if you don't want it
+WATCHFLAGS = -DWATCH
+
+# keystroke latency harness (make bench), needs Xvfb, XTest and Xdamage
+LATENCYLIBS = -lXtst -lXdamage -lXfixes
+
+# libdmenu.so, its matching thread
+LIBDMENULIBS = -lpthread
+
 # Xft, comment if you don't want it
 XFTINC = -I/usr/include/freetype2
 XFTLIBS  = -lXft -lXrender -lfreetype -lz -lfontconfig
 
 # includes and libs
 INCS = -I${X11INC} ${XFTINC}
-LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${XFTLIBS}
+LIBS = -L${X11LIB} -lX11 -lpthread -lrt ${XINERAMALIBS} ${SHMLIBS} ${XFTLIBS}
 
 # flags
-CPPFLAGS = -D_BSD_SOURCE -D_POSIX_C_SOURCE=2 -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS}
+CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_POSIX_C_SOURCE=200809L -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS} ${SHMFLAGS} ${WATCHFLAGS}
 #CFLAGS   = -g -std=c99 -pedantic -Wall -O0 ${INCS} ${CPPFLAGS}
 CFLAGS   = -std=c99 -pedantic -Wall -Os ${INCS} ${CPPFLAGS}
 LDFLAGS  = -s ${LIBS}
@@ -1,10 +1,22 @@
 /* See LICENSE file for copyright and license details. */
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef WATCH
+#include <sys/inotify.h>
+#endif
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
@@ -12,7 +24,11 @@
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif
+#include "bookmarks.h"
 #include "draw.h"
+#include "filetest.h"
+#include "libdmenu.h"
+#include "packed.h"
 
 #define INTERSECT(x,y,w,h,r)  (MAX(0, MIN((x)+(w),(r).x_org+(r).width)  - MAX((x),(r).x_org)) \
                              * MAX(0, MIN((y)+(h),(r).y_org+(r).height) - MAX((y),(r).y_org)))
@@ -21,40 +37,65 @@
 #define DEFFONT "fixed" /* xft example: "Monospace-11" */
 #define HIST_SIZE 20
 #define HIST_LINE_LEN 1024
-
-typedef struct Item Item;
-struct Item {
-	char *text;
-	Item *left, *right;
-};
+#define ARENA_BLOCK (1 << 20) /* bytes of a source read at once, of -watch file */
+#define PREFETCH    2     /* pages settled ahead of the shown one */
+#define MAX_SOURCES MENU_SOURCES /* -src options */
+#define MAX_LISTS 4     /* -list options */
+#define WATCH_EMPTY UINT_MAX         /* free slot in the watch table */
+#define WATCH_GONE (UINT_MAX - 1)    /* slot of a removed item */
 
 struct item_state {
-  char buf[BUFSIZ];
-  char *max_str;
-  size_t max_len;
-  size_t size;
-  size_t items;
+  int fd;
+  pid_t pid;    /* command producing the items, 0 for files and once reaped */
 };
 
-static void appenditem(Item *item, Item **list, Item **last);
+typedef struct {
+	uint64_t hash;         /* of the item text */
+	unsigned int item;     /* or WATCH_EMPTY, WATCH_GONE */
+} Watched;
+
+enum { ListPath, ListDir, ListTree }; /* -list providers */
+
 static void calcoffsets(void);
 static void cleanup(void);
-static char *cistrstr(const char *s, const char *sub);
 static void drawmenu(void);
+static int itemw(size_t i);
 static void grabkeyboard(void);
 static void insert(const char *str, ssize_t n);
+static const char *itemout(size_t i);
+static void itemschanged(void);
 static void keypress(XKeyEvent *ev);
-static void matchstr(void);
-static void matchtok(void);
-static void matchfuzzy(void);
-static char *strchri(const char *s, int c);
+static void listdir(char *path, size_t len, size_t rel, int kind);
+static void listname(const char *name, size_t len);
+static int listcmp(const void *a, const void *b);
+static void match(void);
+static Bool matchcollect(void);
+static void matchneed(size_t n);
+static void matchwait(void);
 static size_t nextrune(int inc);
+static size_t pagestart(size_t end);
+static size_t parsesize(const char *s);
 static size_t utf8length();
 static void paste(void);
+static void readbookmarks(void);
 static void readitems(void);
+static void readlists(void);
+static void readpacked(void);
+static Bool readsources(fd_set *fds);
+static void results(void);
 static void run(void);
 static void setup(void);
+static void startsources(void);
+static void stopsources(void);
 static void usage(void);
+static void watchadd(uint64_t h, unsigned int item);
+#ifdef WATCH
+static void watchcompact(void);
+#endif
+static uint64_t watchhash(const char *s);
+static void watchinit(void);
+static Bool watchpoll(void);
+static size_t watchreload(void);
 static void read_resourses(void);
 static char text[BUFSIZ] = "";
 static char originaltext[BUFSIZ] = "";
@@ -89,30 +130,61 @@ static Bool running = True;
 static Bool filter = False;
 static Bool maskin = False;
 static Bool noinput = False;
+static Bool useshm = False;
 static int ret = 0;
 static Bool quiet = False;
 static DC *dc;
-static Item *items = NULL;
-static Item *matches, *matchend;
-static Item *prev, *curr, *next, *sel;
+static Menu *menu;
+static int matcher = MenuSub;  /* how the menu matches */
+static int options = 0;
+static int maxerr = 0;         /* edits allowed by -a */
+static int delim = '\n';
+static const unsigned int *matches = NULL; /* item indices in display order */
+static size_t nmatches = 0;
+static int *widths = NULL;     /* cached textw() of each item, 0 until measured */
+static size_t nwidths = 0;
+static const char *learnfile = NULL;
+static size_t prev, curr, next, sel;  /* indices into matches */
+static Bool showstats = False;
 static Window win, dim;
 static XIC xic;
 static double opacity = 1.0, dimopacity = 0.0;
 static char hist[HIST_SIZE][HIST_LINE_LEN];
 static char *histfile = NULL;
 static int hcnt = 0;
+static const char *srcspec[MAX_SOURCES];
+static struct item_state srcs[MAX_SOURCES];
+static int nsrcs = 0;
+static const char *packsrc = NULL;  /* -packed descriptor or shm name */
+static const char *bookfile = NULL; /* -bookmarks store */
+static size_t bookfirst = 0, bookend = 0; /* items that are its titles */
+static const char *listspec[MAX_LISTS];
+static FileTest listtest[ListTree];  /* stest options of the providers but trees */
+static int nlists = 0;
+static char **listnames = NULL;     /* names the -list providers found */
+static size_t nlistnames = 0, listnamesize = 0;
+static const char *watchfile = NULL;
+static int watchfd = -1;        /* inotify */
+#ifdef WATCH
+static const char *watchname;   /* watchfile within its directory */
+#endif
+static Watched *watched = NULL; /* items read from watchfile, by text hash */
+static size_t watchsize = 0, watchused = 0, watchlive = 0;
+static unsigned int *watchorder = NULL; /* the same items in file order */
+static size_t watchn = 0, watchordersize = 0;
+static unsigned int *watchpos = NULL;   /* index of each item in watchorder */
+static unsigned int *watchseen = NULL;  /* last reload that found each item */
+static size_t watchitems = 0;
+static unsigned int watchgen = 0;
 
 #define OPAQUE 0xffffffff
 #define OPACITY "_NET_WM_WINDOW_OPACITY"
 
-static int (*fstrncmp)(const char *, const char *, size_t) = strncmp;
-static char *(*fstrstr)(const char *, const char *) = strstr;
-static void (*match)(void) = matchstr;
-static char *(*fstrchr)(const char *, const int) = strchr;
-
 int
 main(int argc, char *argv[]) {
 	Bool fast = False;
+	size_t membudget = SIZE_MAX; /* bytes of item text kept on the heap */
+	long pages;
 	int i;
 
 	for(i = 1; i < argc; i++)
@@ -129,22 +201,29 @@ main(int argc, char *argv[]) {
  			quiet = True;
 		else if(!strcmp(argv[i], "-f"))   /* grabs keyboard before reading stdin */
 			fast = True;
+		else if(!strcmp(argv[i], "-0"))   /* items on stdin are NUL-terminated */
+			delim = '\0';
 		else if(!strcmp(argv[i], "-z"))   /* enable fuzzy matching */
-			match = matchfuzzy;
+			matcher = MenuFuzzy;
  		else if(!strcmp(argv[i], "-r"))
  			filter = True;
-		else if(!strcmp(argv[i], "-i")) { /* case-insensitive item matching */
-			fstrncmp = strncasecmp;
-			fstrstr = cistrstr;
-			fstrchr = strchri;
-		}
+		else if(!strcmp(argv[i], "-i")) /* case-insensitive item matching */
+			options |= MenuFold;
       else if(!strcmp(argv[i], "-mask")) /* password-style input */
          maskin = True;
       else if(!strcmp(argv[i], "-noinput"))
          noinput = True;
+		else if(!strcmp(argv[i], "-shm"))   /* compose frames client side */
+			useshm = True;
+		else if(!strcmp(argv[i], "-stats")) /* report matching statistics */
+			showstats = True;
 
 		else if(!strcmp(argv[i], "-t"))
-			match = matchtok;
+			matcher = MenuTok;
+		else if(!strcmp(argv[i], "-re"))  /* regular expression matching */
+			matcher = MenuRegex;
+		else if(!strcmp(argv[i], "-e"))   /* extended query syntax */
+			options |= MenuExtended;
 		else if(i+1 == argc)
 			usage();
 		/* these options take one argument */
@@ -154,6 +233,30 @@ main(int argc, char *argv[]) {
  			yoffset = atoi(argv[++i]);
  		else if(!strcmp(argv[i], "-w"))
  			width = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-a")) { /* typo tolerant matching */
+			maxerr = atoi(argv[++i]);
+			matcher = MenuApprox;
+		}
+		else if(!strcmp(argv[i], "-src")) { /* read items from more sources */
+			if(nsrcs == MAX_SOURCES)
+				usage();
+			srcspec[nsrcs++] = argv[++i];
+		}
+		else if(!strcmp(argv[i], "-list")) { /* items listed by dmenu itself */
+			if(nlists == MAX_LISTS)
+				usage();
+			listspec[nlists++] = argv[++i];
+		}
+		else if(!strcmp(argv[i], "-learn")) /* preselect what is usually picked */
+			learnfile = argv[++i];
+		else if(!strcmp(argv[i], "-watch")) /* items from a file kept up to date */
+			watchfile = argv[++i];
+		else if(!strcmp(argv[i], "-packed")) /* items mapped from shared memory */
+			packsrc = argv[++i];
+		else if(!strcmp(argv[i], "-bookmarks")) /* titles of a bookmark store */
+			bookfile = argv[++i];
+		else if(!strcmp(argv[i], "-mem"))   /* heap for item text before spilling */
+			membudget = parsesize(argv[++i]);
 		else if(!strcmp(argv[i], "-l"))   /* number of lines in vertical list */
 			lines = atoi(argv[++i]);
 		else if(!strcmp(argv[i], "-h"))   /* minimum height of single line */
@@ -190,10 +293,22 @@ main(int argc, char *argv[]) {
 			selfgcolor = argv[++i];
 		else
 			usage();
+	menu = initmenu(matcher, options, maxerr);
+	/* by default item text may take a quarter of the memory */
+	if(membudget == SIZE_MAX && (pages = sysconf(_SC_PHYS_PAGES)) > 0)
+		membudget = (size_t)pages / 4 * sysconf(_SC_PAGESIZE);
+	menubudget(menu, membudget);
+
+	if(learnfile && !menulearn(menu, learnfile))
+		fprintf(stderr, "dmenu: cannot map %s, not learning: %s\n", learnfile, strerror(errno));
 
 	dc = initdc();
+	/* the commands of -src are not to hold on to the display */
+	fcntl(ConnectionNumber(dc->dpy), F_SETFD, FD_CLOEXEC);
  	read_resourses();
 	initfont(dc, font ? font : DEFFONT);
+	if(useshm && !initshm(dc))
+		fputs("no MIT-SHM rendering support, using Xlib\n", stderr);
 	normcol = initcolor(dc, normfgcolor, normbgcolor);
 	selcol = initcolor(dc, selfgcolor, selbgcolor);
 	dimcol = initcolor(dc, dimcolor, dimcolor);
@@ -201,6 +316,8 @@ main(int argc, char *argv[]) {
 
    if(noinput) {
       grabkeyboard();
+      if(nlists > 0)
+         readitems();
    }
    else if(fast) {
       grabkeyboard();
@@ -210,16 +327,21 @@ main(int argc, char *argv[]) {
       readitems();
       grabkeyboard();
    }
+	startsources();
 	setup();
 	run();
 
 	cleanup();
+	stopsources();
+	if(showstats)
+		menustats(menu, stderr);
+	freemenu(menu);
 	return ret;
 }
 
 
 static int
-writehistory(char *command) {
+writehistory(const char *command) {
 	int i = 0;
 	FILE *f;
 
@@ -293,45 +415,22 @@ read_resourses(void) {
 		opacity = 1.0;
 }
 
-void
-appenditem(Item *item, Item **list, Item **last) {
-	if(*last)
-		(*last)->right = item;
-	else
-		*list = item;
-
-	item->left = *last;
-	item->right = NULL;
-	*last = item;
-}
-
 void
 calcoffsets(void) {
 	int i, n;
 
-	if(lines > 0)
-		n = lines * bh;
-	else
-		n = mw - (promptw + inputw + textw(dc, "<") + textw(dc, ">"));
 	/* calculate which items will begin the next page and previous page */
-	for(i = 0, next = curr; next; next = next->right)
-		if((i += (lines > 0) ? bh : MIN(textw(dc, next->text), n)) > n)
-			break;
-	for(i = 0, prev = curr; prev && prev->left; prev = prev->left)
-		if((i += (lines > 0) ? bh : MIN(textw(dc, prev->left->text), n)) > n)
+	prev = pagestart(curr);
+	if(lines > 0) {
+		next = MIN(curr + lines, nmatches);
+		return;
+	}
+	n = mw - (promptw + inputw + textw(dc, "<") + textw(dc, ">"));
+	for(i = 0, next = curr; next < nmatches; next++)
+		if((i += MIN(itemw(next), n)) > n)
 			break;
 }
 
-char *
-cistrstr(const char *s, const char *sub) {
-	size_t len;
-
-	for(len = strlen(sub); *s; s++)
-		if(!strncasecmp(s, sub, len))
-			return (char *)s;
-	return NULL;
-}
-
 void
 cleanup(void) {
     freecol(dc, normcol);
@@ -344,25 +443,29 @@ cleanup(void) {
     freedc(dc);
 }
 
+/* length asterisks, cut from a string of them that is only filled once */
 const char *
-createmaskinput(char *maskinput, int length)
+createmaskinput(int length)
 {
-   if (length <= 0) {
-      *maskinput = '\0';
-   } else {
-      memset(maskinput, '*', length);
-      maskinput[length] = '\0';
-   }
+   static char stars[sizeof text];
+   static int end = -1;
+
+   if (end == -1)
+      memset(stars, '*', sizeof stars - 1);
+   else
+      stars[end] = '*';
+   end = MAX(length, 0);
+   stars[end] = '\0';
 
-   return (maskinput);
+   return (stars);
 }
 
 void
 drawmenu(void) {
 	int curpos;
-   char maskinput[sizeof text];
    int length = maskin ? utf8length() : cursor;
-	Item *item;
+   const char *input = maskin ? createmaskinput(length) : text;
+	size_t i;
 
 	dc->x = 0;
 	dc->y = 0;
@@ -378,9 +481,9 @@ drawmenu(void) {
 
 
 	/* draw input field */
-	dc->w = (lines > 0 || !matches) ? mw - dc->x : inputw;
-	drawtext(dc, maskin ? createmaskinput(maskinput, length) : text, normcol);
-	if((curpos = textnw(dc, maskin ? maskinput : text, length) + dc->font.height/2) < dc->w)
+	dc->w = (lines > 0 || !nmatches) ? mw - dc->x : inputw;
+	drawtext(dc, input, normcol);
+	if((curpos = textnw(dc, input, length) + dc->font.height/2) < dc->w)
 		drawrect(dc, curpos, (dc->h - dc->font.height)/2 + 1, 1, dc->font.height -1, True, normcol->FG);
 
 
@@ -388,28 +491,28 @@ drawmenu(void) {
         if(lines > 0) {
             /* draw vertical list */
             dc->w = mw - dc->x;
-            for(item = curr; item != next; item = item->right) {
+            for(i = curr; i != next; i++) {
                 dc->y += dc->h;
-                drawtext(dc, item->text, (item == sel) ? selcol : normcol);
+                drawtext(dc, menuitem(menu, matches[i]), (i == sel) ? selcol : normcol);
             }
         }
-        else if(matches) {
+        else if(nmatches) {
             /* draw horizontal list */
             dc->x += inputw;
             dc->w = textw(dc, "<");
-            if(curr->left)
+            if(curr > 0)
                 drawtext(dc, "<", normcol);
-            for(item = curr; item != next; item = item->right) {
+            for(i = curr; i != next; i++) {
                 dc->x += dc->w;
-                dc->w = MIN(textw(dc, item->text), mw - dc->x - textw(dc, ">"));
-                drawtext(dc, item->text, (item == sel) ? selcol : normcol);
-                if (item == sel)
+                dc->w = MIN(itemw(i), mw - dc->x - textw(dc, ">"));
+                drawtext(dc, menuitem(menu, matches[i]), (i == sel) ? selcol : normcol);
+                if (i == sel)
                 	drawrect(dc, 0, dc->h-under_height, dc->w, under_height, True, undercol->BG);
 
             }
             dc->w = textw(dc, ">");
             dc->x = mw - dc->w;
-            if(next)
+            if(next < nmatches)
                 drawtext(dc, ">", normcol);
         }
     }
@@ -442,6 +545,54 @@ insert(const char *str, ssize_t n) {
 	match();
 }
 
+/* bring the shown result up to date with the items added and removed,
+ * keeping the selected item where it was if it is left */
+void
+itemschanged(void) {
+	unsigned int selitem = 0, curritem = 0;
+	size_t i;
+	Bool keep;
+
+	/* the results moved when the menu grew */
+	results();
+	if((keep = (nmatches > 0))) {
+		selitem = matches[sel];
+		curritem = matches[curr];
+	}
+	menuupdate(menu);
+	results();
+	keep &= !menupending(menu);
+	curr = sel = 0;
+	for(i = 0; keep && i < nmatches; i++) {
+		if(matches[i] == curritem)
+			curr = i;
+		if(matches[i] == selitem)
+			sel = i;
+	}
+	curr = MIN(curr, sel);
+	calcoffsets();
+	if(sel >= next) {
+		curr = sel;
+		calcoffsets();
+	}
+}
+
+int
+itemw(size_t i) {
+	size_t n = menuitems(menu);
+
+	if(n > nwidths) {
+		n = MAX(2 * nwidths, n);
+		if(!(widths = realloc(widths, n * sizeof *widths)))
+			eprintf("cannot realloc %u bytes:", n * sizeof *widths);
+		memset(widths + nwidths, 0, (n - nwidths) * sizeof *widths);
+		nwidths = n;
+	}
+	if(!widths[matches[i]])
+		widths[matches[i]] = textw(dc, menuitem(menu, matches[i]));
+	return widths[matches[i]];
+}
+
 void
 keypress(XKeyEvent *ev) {
 	char buf[32];
@@ -522,30 +673,27 @@ keypress(XKeyEvent *ev) {
 			cursor = strlen(text);
 			break;
 		}
-		if(next) {
+		matchwait();
+		if(next < nmatches) {
 			/* jump to end of list and position items in reverse */
-			curr = matchend;
+			curr = pagestart(nmatches);
 			calcoffsets();
-			curr = prev;
-			calcoffsets();
-			while(next && (curr = curr->right))
-				calcoffsets();
 		}
-		sel = matchend;
+		sel = nmatches ? nmatches - 1 : 0;
 		break;
 	case XK_Escape:
         ret = EXIT_FAILURE;
         running = False;
 	case XK_Home:
-		if(sel == matches) {
+		if(sel == 0) {
 			cursor = 0;
 			break;
 		}
-		sel = curr = matches;
+		sel = curr = 0;
 		calcoffsets();
 		break;
 	case XK_Left:
-		if(cursor > 0 && (!sel || !sel->left || lines > 0)) {
+		if(cursor > 0 && (sel == 0 || lines > 0)) {
 			cursor = nextrune(-1);
 			break;
 		}
@@ -553,38 +701,44 @@ keypress(XKeyEvent *ev) {
 			return;
 		/* fallthrough */
 	case XK_Up:
-		if(sel && sel->left && (sel = sel->left)->right == curr) {
+		if(sel > 0 && sel-- == curr) {
 			curr = prev;
 			calcoffsets();
 		}
 		break;
 	case XK_Next:
-		if(!next)
+		matchneed(2 * next - curr);
+		if(next >= nmatches)
 			return;
 		sel = curr = next;
 		calcoffsets();
 		break;
 	case XK_Prior:
-		if(!prev)
+		if(!nmatches)
 			return;
 		sel = curr = prev;
 		calcoffsets();
 		break;
 	case XK_Return:
 	case XK_KP_Enter:
- 		if((ev->state & ShiftMask) || !sel){
+		if(filter)
+			matchwait();
+		else if(!(ev->state & ShiftMask))
+			matchneed(sel + 1);
+ 		if((ev->state & ShiftMask) || !nmatches){
  			puts(text);
  			writehistory(text);
  		}
  		else if(!filter){
- 			puts(sel->text);
- 			writehistory(sel->text);
+ 			puts(itemout(matches[sel]));
+ 			writehistory(menuitem(menu, matches[sel]));
+ 			menupick(menu, text, matches[sel]);
  		}
  		else {
- 			for(Item *item = sel; item; item = item->right)
- 				puts(item->text);
- 			for(Item *item = matches; item != sel; item = item->right)
- 				puts(item->text);
+ 			for(size_t i = sel; i < nmatches; i++)
+ 				puts(itemout(matches[i]));
+ 			for(size_t i = 0; i != sel; i++)
+ 				puts(itemout(matches[i]));
  		}
 		ret = EXIT_SUCCESS;
 		running = False;
@@ -597,22 +751,24 @@ keypress(XKeyEvent *ev) {
 			return;
 		/* fallthrough */
 	case XK_Down:
-		if(sel && sel->right && (sel = sel->right) == next) {
+		matchneed(sel + 2);
+		if(sel + 1 < nmatches && ++sel == next) {
 			curr = next;
 			calcoffsets();
 		}
 		break;
 	case XK_Tab:
-		if(!sel)
+		matchneed(sel + 2);
+		if(!nmatches)
 			return;
-		if(strcmp(text, sel->text)) {
+		if(strcmp(text, menuitem(menu, matches[sel]))) {
 			strncpy(originaltext, text, sizeof originaltext);
-			strncpy(text, sel->text, sizeof text);
+			strncpy(text, menuitem(menu, matches[sel]), sizeof text);
 			cursor = strlen(text);
 		} else {
-			if(sel && sel->right) {
-				sel = sel->right;
-				strncpy(text, sel->text, sizeof text);
+			if(sel + 1 < nmatches) {
+				sel++;
+				strncpy(text, menuitem(menu, matches[sel]), sizeof text);
 				cursor = strlen(text);
 			}
 			else {
@@ -623,17 +779,18 @@ keypress(XKeyEvent *ev) {
 		}
 		break;
 	case XK_ISO_Left_Tab:
-		if(!sel)
+		matchwait();
+		if(!nmatches)
 			return;
-		if(strcmp(text, sel->text)) {
-			sel = matchend;
+		if(strcmp(text, menuitem(menu, matches[sel]))) {
+			sel = nmatches - 1;
 			strncpy(originaltext, text, sizeof originaltext);
-			strncpy(text, sel->text, sizeof text);
+			strncpy(text, menuitem(menu, matches[sel]), sizeof text);
 			cursor = strlen(text);
 		} else {
-			if(sel && sel->left) {
-				sel = sel->left;
-				strncpy(text, sel->text, sizeof text);
+			if(sel > 0) {
+				sel--;
+				strncpy(text, menuitem(menu, matches[sel]), sizeof text);
 				cursor = strlen(text);
 			}
 			else {
@@ -647,120 +804,106 @@ keypress(XKeyEvent *ev) {
 	drawmenu();
 }
 
-char *
-strchri(const char *s, int c) {
-	char *u, *l;
-	if(!isalpha(c)) return strchr(s, c);
-	if(isupper(c)) {
-		u = strchr(s, c);
-		l = strchr(s, tolower(c));
-	}
-	else {
-		l = strchr(s, c);
-		u = strchr(s, toupper(c));
+/* collect the names of the files in directory path, which is len bytes
+ * long, for -list.  Trees are walked to the bottom and their files named
+ * from byte rel of their path on. */
+void
+listdir(char *path, size_t len, size_t rel, int kind) {
+	struct dirent *d;
+	struct stat st;
+	size_t n;
+	DIR *dir;
+	int type;
+
+	if(!(dir = opendir(path)))
+		return;
+	path[len] = '/';
+	while((d = readdir(dir))) {
+		n = strlen(d->d_name);
+		if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..") || len + n + 1 >= PATH_MAX)
+			continue;
+		memcpy(path + len + 1, d->d_name, n + 1);
+		if(kind == ListTree) {
+			/* like find -type f, links are not followed */
+			if((type = d->d_type) == DT_UNKNOWN)
+				type = lstat(path, &st) ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_DIR
+				     : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+			if(type == DT_DIR)
+				listdir(path, len + n + 1, rel, kind);
+			else if(type == DT_REG)
+				listname(path + rel, len + n + 1 - rel);
+		}
+		/* like stest -l, hidden files only show up in trees */
+		else if(filetest(&listtest[kind], path, d->d_name))
+			listname(d->d_name, n);
 	}
+	closedir(dir);
+	path[len] = '\0';
 }
 
+int
+listcmp(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-
+/* keep a copy of name until readlists() has added it */
 void
-matchstr(void) {
-	static char **tokv = NULL;
-	static int tokn = 0;
-
-	char buf[sizeof text], *s;
-	int i, tokc = 0;
-	size_t len;
-	Item *item, *lprefix, *lsubstr, *prefixend, *substrend;
-
-	strcpy(buf, text);
-	/* separate input text into tokens to be matched individually */
-	for(s = strtok(buf, " "); s; tokv[tokc-1] = s, s = strtok(NULL, " "))
-		if(++tokc > tokn && !(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
-			eprintf("cannot realloc %u bytes\n", tokn * sizeof *tokv);
-	len = tokc ? strlen(tokv[0]) : 0;
-
-	matches = lprefix = lsubstr = matchend = prefixend = substrend = NULL;
-	for(item = items; item && item->text; item++) {
-		for(i = 0; i < tokc; i++)
-			if(!fstrstr(item->text, tokv[i]))
-				break;
-		if(i != tokc) /* not all tokens match */
-			continue;
-		/* exact matches go first, then prefixes, then substrings */
-		if(!tokc || !fstrncmp(tokv[0], item->text, len+1))
-			appenditem(item, &matches, &matchend);
-		else if(!fstrncmp(tokv[0], item->text, len))
-			appenditem(item, &lprefix, &prefixend);
-		else
-			appenditem(item, &lsubstr, &substrend);
-	}
-	if(lprefix) {
-		if(matches) {
-			matchend->right = lprefix;
-			lprefix->left = matchend;
-		}
-		else
-			matches = lprefix;
-		matchend = prefixend;
+listname(const char *name, size_t len) {
+	if(nlistnames == listnamesize) {
+		listnamesize = MAX(2 * listnamesize, BUFSIZ);
+		if(!(listnames = realloc(listnames, listnamesize * sizeof *listnames)))
+			eprintf("cannot realloc %u bytes:", listnamesize * sizeof *listnames);
 	}
-	if(lsubstr) {
-		if(matches) {
-			matchend->right = lsubstr;
-			lsubstr->left = matchend;
-		}
-		else
-			matches = lsubstr;
-		matchend = substrend;
-	}
-	curr = sel = matches;
-	calcoffsets();
+	if(!(listnames[nlistnames] = malloc(len + 1)))
+		eprintf("cannot malloc %u bytes:", len + 1);
+	memcpy(listnames[nlistnames++], name, len + 1);
 }
 
+/* start matching the current text; large lists are scanned by the worker
+ * of the menu */
 void
-matchtok(void) {
-	char buf[sizeof text];
-	char **tokv, *s;
-	int tokc, i;
-	Item *item, *end;
-
-	tokc = 0;
-	tokv = NULL;
-	strcpy(buf, text);
-	for(s = strtok(buf, " "); s; tokv[tokc-1] = s, s = strtok(NULL, " "))
-		if(!(tokv = realloc(tokv, ++tokc * sizeof *tokv)))
-			eprintf("cannot realloc %u bytes\n", tokc * sizeof *tokv);
-
-	matches = end = NULL;
-	for(item = items; item->text; item++) {
-		for(i = 0; i < tokc; i++)
-			if(!fstrstr(item->text, tokv[i]))
-				break;
-		if(i == tokc)
-			appenditem(item, &matches, &end);
-	}
-	free(tokv);
-	curr = prev = next = sel = matches;
+match(void) {
+	size_t pos[2] = { curr, sel };
+
+	if(!menumatch(menu, text, PREFETCH * (lines ? lines : mw / MAX(dc->font.height, 1) + 1), pos))
+		return;
+	results();
+	curr = pos[0];
+	sel = pos[1];
 	calcoffsets();
 }
 
+/* take over whatever the worker has found so far, True if that changed the
+ * result */
+Bool
+matchcollect(void) {
+	/* the settled matches keep their places, so does a selection among them */
+	Bool keep = (sel < menusettled(menu));
+
+	if(!menucollect(menu))
+		return False;
+	results();
+	if(!keep)
+		curr = sel = 0;
+	calcoffsets();
+	return True;
+}
+
+/* make sure the first n matches are final, waiting for the worker if the
+ * ones settled so far do not reach that far */
 void
-matchfuzzy(void) {
-	int i;
-	size_t len;
-	Item *item;
-	char *pos;
-	
-	len = strlen(text);
-	matches = matchend = NULL;
-	for(item = items; item && item->text; item++) {
-		i = 0;
-		for(pos = fstrchr(item->text, text[i]); pos && text[i]; i++, pos = fstrchr(pos+1, text[i]));
-		if(i == len) appenditem(item, &matches, &matchend);
-	}
+matchneed(size_t n) {
+	if(menupending(menu) && n > menusettled(menu))
+		matchwait();
+}
 
-	curr = sel = matches;
-	calcoffsets();
+/* block until the worker has finished the current query */
+void
+matchwait(void) {
+	if(!menupending(menu))
+		return;
+	menuwait(menu);
+	matchcollect();
 }
 
 size_t
@@ -788,6 +931,36 @@ utf8length()
    return (length);
 }
 
+/* first index of the page that ends just before match 'end' */
+size_t
+pagestart(size_t end) {
+	int i, n;
+
+	if(lines > 0)
+		return end > lines ? end - lines : 0;
+	n = mw - (promptw + inputw + textw(dc, "<") + textw(dc, ">"));
+	for(i = 0; end > 0; end--)
+		if((i += MIN(itemw(end - 1), n)) > n)
+			break;
+	return end;
+}
+
+/* a byte count with an optional k, M or G suffix */
+size_t
+parsesize(const char *s) {
+	char *end;
+	size_t n = strtoul(s, &end, 10);
+
+	switch(*end) {
+	case 'G': case 'g': n <<= 10; /* fallthrough */
+	case 'M': case 'm': n <<= 10; /* fallthrough */
+	case 'K': case 'k': n <<= 10; break;
+	case '\0': break;
+	default: usage();
+	}
+	return n;
+}
+
 void
 paste(void) {
 	char *p, *q;
@@ -803,71 +976,279 @@ paste(void) {
 	drawmenu();
 }
 
-/* Return either length, or -1 for failure */
-size_t
-readitem(FILE *fd, struct item_state *s) {
-  char *p;
-  size_t len = -1;
-
-  if (fgets(s->buf, BUFSIZ, fd)) {
-    if (s->items + 1 >= s->size / sizeof *items) {
-      if (!(items = realloc(items, (s->size += BUFSIZ)))) {
-        eprintf("cannot realloc %u bytes:", s->size);
-      }
+void
+readitems(void) {
+  int fd;
+
+  if (histfile && (fd = open(histfile, O_RDONLY)) != -1) {
+    while (menuread(menu, fd, '\n', 0) > 0);
+    close(fd);
+    for (; hcnt < (int)MIN(menuitems(menu), HIST_SIZE); hcnt++) {
+      strncpy(hist[hcnt], menuitem(menu, hcnt), HIST_LINE_LEN - 1);
+      hist[hcnt][HIST_LINE_LEN - 1] = '\0';
     }
+  }
 
-    if((p = strchr(s->buf, '\n'))) {
-		  *p = '\0';
-    }
+  /* a watched file and sources replace stdin */
+  if (watchfile) {
+    watchinit();
+    watchreload();
+  }
 
-    len = strlen(s->buf);
+  /* read each line from stdin and add it to the item list */
+  if (packsrc)
+    readpacked();
+  else if (bookfile)
+    readbookmarks();
+  else if (!watchfile && !noinput && nsrcs == 0)
+    while (menuread(menu, STDIN_FILENO, delim, 0) > 0);
+  if (nlists > 0)
+    readlists();
+
+  /* items from sources come in while dmenu runs */
+  if (nsrcs > 0) {
+    inputw = INT_MAX;
+    return;
+  }
+  inputw = menulongest(menu) ? textw(dc, menulongest(menu)) : 0;
+  lines = MIN(lines, menuitems(menu));
+}
 
-    if (!(items[s->items].text = strdup(s->buf))) {
-		  eprintf("cannot strdup %u bytes:", len + 1);
+/* add what the -list providers find after the items read, each sorted and
+ * without the names listed before.  No other program is run for it. */
+void
+readlists(void) {
+  char path[PATH_MAX], *p, *q, *env;
+  const char *t;
+  unsigned int *seen;
+  size_t i, j, k, size, first, old = menuitems(menu);
+  int l, kind;
+
+  /* stest -fl lists a dir, -flx $PATH */
+  FLAG(&listtest[ListDir], 'f') = FLAG(&listtest[ListPath], 'f') = 1;
+  FLAG(&listtest[ListPath], 'x') = 1;
+  for (l = 0; l < nlists; l++) {
+    first = nlistnames;
+    if (!strcmp(listspec[l], "path")) {
+      if (!(env = getenv("PATH")))
+        continue;
+      for (p = env; *p; p = q + (*q != '\0')) {
+        q = p + strcspn(p, ":");
+        if (q > p && q - p < PATH_MAX - 1) {
+          memcpy(path, p, q - p);
+          path[q - p] = '\0';
+          listdir(path, q - p, 0, ListPath);
+        }
+      }
     }
-
-    if(len > s->max_len) {
-      s->max_len = len;
-      s->max_str = items[s->items].text;
+    else {
+      kind = strncmp(listspec[l], "tree:", 5) ? ListDir : ListTree;
+      if (kind == ListDir && strncmp(listspec[l], "dir:", 4))
+        eprintf("unknown list '%s'\n", listspec[l]);
+      p = strchr(listspec[l], ':') + 1;
+      /* names in trees are relative to their root */
+      for (k = strlen(p); k > 1 && p[k - 1] == '/'; k--);
+      if (k >= PATH_MAX - 1)
+        continue;
+      memcpy(path, p, k);
+      path[k] = '\0';
+      listdir(path, k, k + 1, kind);
     }
-
-    s->items++;
+    qsort(listnames + first, nlistnames - first, sizeof *listnames, listcmp);
   }
 
-  return len;
+  /* an item is only listed once, under the first name found for it */
+  for (size = 1024; size < 2 * (old + nlistnames); size *= 2);
+  if (!(seen = malloc(size * sizeof *seen)))
+    eprintf("cannot malloc %u bytes:", size * sizeof *seen);
+  memset(seen, 0xff, size * sizeof *seen);
+  for (i = 0; i < old + nlistnames; i++) {
+    t = i < old ? menuitem(menu, i) : listnames[i - old];
+    for (j = watchhash(t) & (size - 1); seen[j] != UINT_MAX; j = (j + 1) & (size - 1))
+      if (!strcmp(menuitem(menu, seen[j]), t))
+        break;
+    if (seen[j] != UINT_MAX)
+      continue;
+    if (i >= old)
+      menuadd(menu, t, strlen(t), 0);
+    seen[j] = i < old ? i : menuitems(menu) - 1;
+  }
+  free(seen);
+  for (i = 0; i < nlistnames; i++)
+    free(listnames[i]);
+  free(listnames);
+  listnames = NULL;
+  nlistnames = listnamesize = 0;
 }
 
+/* map the packed items of -packed and take their strings as they are */
 void
-readitems(void) {
-  struct item_state s;
-  FILE *f;
-  size_t len = 0;
+readpacked(void) {
+  const PackedHeader *h;
+  const uint64_t *off;
+  struct stat st;
+  char *base;
+  size_t i;
+  int fd;
+
+  if (packsrc[0] == '/')
+    fd = shm_open(packsrc, O_RDONLY, 0);
+  else
+    fd = atoi(packsrc);
+  if (fd == -1 || fstat(fd, &st) == -1)
+    eprintf("cannot open %s:", packsrc);
+  if ((size_t)st.st_size < sizeof *h)
+    eprintf("%s: not packed items\n", packsrc);
+  if ((base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    eprintf("cannot map %s:", packsrc);
+  close(fd);
+  h = (const PackedHeader *)base;
+  if (h->magic != PACKED_MAGIC || h->version != PACKED_VERSION
+  || h->size > (uint64_t)st.st_size || h->size < PACKED_DATA(0)
+  || h->count > (h->size - sizeof *h) / sizeof *off - 1)
+    eprintf("%s: not packed items\n", packsrc);
+  madvise(base, h->size, MADV_SEQUENTIAL);
+  off = PACKED_OFFSETS(h);
+  if (off[0] < PACKED_DATA(h->count) || off[h->count] > h->size)
+    eprintf("%s: bad offsets\n", packsrc);
+  for (i = 0; i < h->count; i++) {
+    /* each string must end just before the next one starts */
+    if (off[i + 1] <= off[i] || base[off[i + 1] - 1] != '\0')
+      eprintf("%s: bad item %zu\n", packsrc, i);
+    menuaddref(menu, base + off[i], off[i + 1] - off[i] - 1, 0);
+  }
+}
 
-  bzero(&s, sizeof s);
+/* map the bookmark store of -bookmarks and list the titles in it as they
+ * are, each is followed by its url */
+void
+readbookmarks(void) {
+  BookmarkHeader h;
+  const uint64_t *index;
+  const char *t;
+  struct stat st;
+  char *base;
+  uint64_t off;
+  size_t i, len;
+  int fd;
+
+  if ((fd = open(bookfile, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+    eprintf("cannot open %s:", bookfile);
+  if ((size_t)st.st_size < sizeof h)
+    eprintf("%s: not a bookmark store\n", bookfile);
+  if ((base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    eprintf("cannot map %s:", bookfile);
+  close(fd);
+  /* bmstore rewrites the header in place, only the copy is to be trusted */
+  memcpy(&h, base, sizeof h);
+  if (h.magic != BOOKMARKS_MAGIC || h.version != BOOKMARKS_VERSION
+  || h.size > (uint64_t)st.st_size || h.index < sizeof h || h.index % sizeof off
+  || h.index > h.size || h.count > (h.size - h.index) / sizeof off)
+    eprintf("%s: not a bookmark store\n", bookfile);
+  index = BOOKMARK_OFFSETS(base, h);
+  bookfirst = menuitems(menu);
+  for (i = 0; i < h.count; i++) {
+    /* a title and its url, both ended before the index */
+    if ((off = index[i]) < sizeof h || off >= h.index)
+      eprintf("%s: bad bookmark %zu\n", bookfile, i);
+    t = base + off;
+    len = strnlen(t, h.index - off);
+    if (off + len + 1 >= h.index || !memchr(t + len + 1, '\0', h.index - off - len - 1))
+      eprintf("%s: bad bookmark %zu\n", bookfile, i);
+    menuaddref(menu, t, len, 0);
+  }
+  bookend = menuitems(menu);
+}
 
-  if (histfile && (f = fopen(histfile, "r"))) {
-    while ((len = readitem(f, &s)) != (size_t)-1) {
-      strncpy(hist[hcnt], s.buf, MIN(len, HIST_LINE_LEN - 1));
-      hist[hcnt++][HIST_LINE_LEN - 1] = '\0';
+/* read what the sources set in fds have produced, True if that was any
+ * items */
+Bool
+readsources(fd_set *fds) {
+  struct item_state *s;
+  size_t old = menuitems(menu), got;
+  ssize_t n;
+
+  for (s = srcs; s < srcs + nsrcs; s++) {
+    if (s->fd == -1 || !FD_ISSET(s->fd, fds))
+      continue;
+    /* take up to a block at once, each round rescans the new items and
+     * sorts all matches again. Only our own pipes are non-blocking. */
+    got = 0;
+    do {
+      n = menuread(menu, s->fd, delim, s - srcs);
+      got += MAX(n, 0);
+    } while (n > 0 && got < ARENA_BLOCK && s->pid > 0);
+    if (n == 0 || (n == -1 && errno != EAGAIN)) {
+      close(s->fd);
+      s->fd = -1;
+      /* one that lingers is reaped by stopsources() */
+      if (s->pid > 0 && waitpid(s->pid, NULL, WNOHANG) == s->pid)
+        s->pid = 0;
     }
-    fclose(f);
   }
+  if (menuitems(menu) == old)
+    return False;
+  itemschanged();
+  return True;
+}
 
-  /* read each line from stdin and add it to the item list */
-  while(readitem(stdin, &s) != (size_t)-1);
+/* what is printed for item i, the url of a bookmark */
+const char *
+itemout(size_t i) {
+	const char *s = menuitem(menu, i);
+
+	return (i >= bookfirst && i < bookend) ? s + strlen(s) + 1 : s;
+}
 
-  if(items)
-    items[s.items].text = NULL;
-  inputw = s.max_str ? textw(dc, s.max_str) : 0;
-  lines = MIN(lines, s.items);
+/* point matches at the current result of the menu */
+void
+results(void) {
+	matches = menuresults(menu);
+	nmatches = menucount(menu);
 }
 
 void
 run(void) {
 	XEvent ev;
-
-	while(running && !XNextEvent(dc->dpy, &ev)) {
-		if(XFilterEvent(&ev, win))
+	fd_set fds;
+	int xfd = ConnectionNumber(dc->dpy), wakefd, maxfd, i;
+	Bool busy;
+
+	while(running) {
+		if(!XPending(dc->dpy)) {
+			/* wait for X events, news from the match worker or more items */
+			FD_ZERO(&fds);
+			FD_SET(xfd, &fds);
+			wakefd = menufd(menu);
+			maxfd = MAX(xfd, wakefd);
+			if(wakefd != -1)
+				FD_SET(wakefd, &fds);
+			busy = menubusy(menu);
+			/* the item list must not move while the worker reads it */
+			for(i = 0; i < nsrcs && !busy; i++)
+				if(srcs[i].fd != -1) {
+					FD_SET(srcs[i].fd, &fds);
+					maxfd = MAX(maxfd, srcs[i].fd);
+				}
+			if(watchfd != -1 && !busy) {
+				FD_SET(watchfd, &fds);
+				maxfd = MAX(maxfd, watchfd);
+			}
+			if(select(maxfd + 1, &fds, NULL, NULL, NULL) == -1) {
+				if(errno == EINTR)
+					continue;
+				eprintf("select failed:");
+			}
+			if(wakefd != -1 && FD_ISSET(wakefd, &fds) && matchcollect())
+				drawmenu();
+			if(!busy && readsources(&fds))
+				drawmenu();
+			if(!busy && watchfd != -1 && FD_ISSET(watchfd, &fds) && watchpoll())
+				drawmenu();
+			continue;
+		}
+		XNextEvent(dc->dpy, &ev);
+		if(XFilterEvent(&ev, win) || dcevent(dc, &ev))
 			continue;
 		switch(ev.type) {
 		case Expose:
@@ -889,6 +1270,63 @@ run(void) {
 	}
 }
 
+/* open the files and start the commands given with -src.  Each command
+ * only inherits its own pipe. */
+void
+startsources(void) {
+	struct item_state *s;
+	const char *spec;
+	int fd[2];
+
+	for(s = srcs; s < srcs + nsrcs; s++) {
+		spec = srcspec[s - srcs];
+		if(!strncmp(spec, "file:", 5)) {
+			if((s->fd = open(spec + 5, O_RDONLY | O_CLOEXEC)) == -1)
+				eprintf("cannot open '%s':", spec + 5);
+			continue;
+		}
+		if(!strncmp(spec, "fd:", 3)) {
+			s->fd = atoi(spec + 3);
+			fcntl(s->fd, F_SETFD, FD_CLOEXEC);
+			continue;
+		}
+		if(pipe(fd) == -1)
+			eprintf("cannot create pipe:");
+		fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+		if((s->pid = fork()) == -1)
+			eprintf("cannot fork:");
+		if(s->pid == 0) {
+			dup2(fd[1], STDOUT_FILENO);
+			close(fd[0]);
+			close(fd[1]);
+			execl("/bin/sh", "sh", "-c", spec, (char *)NULL);
+			_exit(127);
+		}
+		close(fd[1]);
+		s->fd = fd[0];
+		fcntl(s->fd, F_SETFL, O_NONBLOCK);
+	}
+}
+
+/* end the commands not reaped yet and reap them, so none is left a zombie
+ * or holds up the caller reading our output.  A zombie ignores the signal. */
+void
+stopsources(void) {
+	struct item_state *s;
+
+	for(s = srcs; s < srcs + nsrcs; s++) {
+		if(s->pid > 0)
+			kill(s->pid, SIGTERM);
+		if(s->fd != -1)
+			close(s->fd);
+		s->fd = -1;
+		if(s->pid > 0)
+			while(waitpid(s->pid, NULL, 0) == -1 && errno == EINTR);
+		s->pid = 0;
+	}
+}
+
 void
 setup(void) {
 	int x, y, screen = DefaultScreen(dc->dpy);
@@ -1029,10 +1467,235 @@ setup(void) {
 
 void
 usage(void) {
-	fputs("usage: dmenu [-b] [-q] [-f] [-r] [-i] [-z] [-t] [-mask] [-noinput]\n"
+	fputs("usage: dmenu [-b] [-q] [-f] [-0] [-r] [-i] [-z] [-t] [-re] [-e] [-a errors]\n"
+	      "             [-mask] [-noinput] [-shm] [-stats]\n"
 				"             [-s screen] [-name name] [-class class] [ -o opacity]\n"
 				"             [-dim opcity] [-dc color] [-l lines] [-p prompt] [-fn font]\n"
 	      "             [-x xoffset] [-y yoffset] [-h height] [-w width] [-uh height]\n"
-	      "             [-nb color] [-nf color] [-sb color] [-sf color] [-uc color] [-hist histfile] [-v]\n", stderr);
+	      "             [-nb color] [-nf color] [-sb color] [-sf color] [-uc color] [-hist histfile]\n"
+	      "             [-src source] [-list provider] [-watch file] [-packed fd] [-mem size]\n"
+	      "             [-bookmarks file] [-learn file] [-v]\n", stderr);
 	exit(EXIT_FAILURE);
 }
+
+/* file item from watchfile under the hash h of its text */
+void
+watchadd(uint64_t h, unsigned int item) {
+	Watched *old = watched;
+	size_t i, k, oldsize = watchsize;
+
+	if(4 * (watchused + 1) > 3 * watchsize) {
+		/* grow, or just sweep out the removed items */
+		for(watchsize = MAX(watchsize, 1024); 2 * (watchlive + 1) > watchsize; watchsize *= 2);
+		if(!(watched = malloc(watchsize * sizeof *watched)))
+			eprintf("cannot malloc %u bytes:", watchsize * sizeof *watched);
+		for(i = 0; i < watchsize; i++)
+			watched[i].item = WATCH_EMPTY;
+		watchused = watchlive = 0;
+		for(k = 0; k < oldsize; k++)
+			if(old[k].item < WATCH_GONE) {
+				for(i = old[k].hash & (watchsize - 1); watched[i].item != WATCH_EMPTY; i = (i + 1) & (watchsize - 1));
+				watched[i] = old[k];
+				watchused++;
+				watchlive++;
+			}
+		free(old);
+	}
+	for(i = h & (watchsize - 1); watched[i].item != WATCH_EMPTY; i = (i + 1) & (watchsize - 1));
+	watched[i].hash = h;
+	watched[i].item = item;
+	watchused++;
+	watchlive++;
+}
+
+#ifdef WATCH
+/* drop the removed items from the menu and renumber the items the watch
+ * tables, the widths and the bookmark titles refer to */
+void
+watchcompact(void) {
+	unsigned int *map;
+	size_t i, n = menuitems(menu);
+
+	if(!(map = malloc(n * sizeof *map)))
+		eprintf("cannot malloc %u bytes:", n * sizeof *map);
+	menucompact(menu, map);
+	/* items only move down */
+	for(i = 0; i < n; i++) {
+		if(map[i] == UINT_MAX)
+			continue;
+		if(i < nwidths)
+			widths[map[i]] = widths[i];
+		if(i < watchitems) {
+			watchpos[map[i]] = watchpos[i];
+			watchseen[map[i]] = watchseen[i];
+		}
+	}
+	if(nwidths > menuitems(menu))
+		memset(widths + menuitems(menu), 0, (nwidths - menuitems(menu)) * sizeof *widths);
+	for(i = 0; i < watchsize; i++)
+		if(watched[i].item < WATCH_GONE)
+			watched[i].item = map[watched[i].item];
+	for(i = 0; i < watchn; i++)
+		watchorder[i] = map[watchorder[i]];
+	if(bookend > bookfirst) {
+		bookend = map[bookfirst] + (bookend - bookfirst);
+		bookfirst = map[bookfirst];
+	}
+	free(map);
+	results();
+	sel = MIN(sel, nmatches ? nmatches - 1 : 0);
+	curr = MIN(curr, sel);
+	calcoffsets();
+}
+#endif
+
+uint64_t
+watchhash(const char *s) {
+	uint64_t h = 14695981039346656037ULL;
+
+	for(; *s; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	return h;
+}
+
+void
+watchinit(void) {
+#ifdef WATCH
+	char dir[PATH_MAX];
+	const char *p;
+
+	if((p = strrchr(watchfile, '/'))) {
+		snprintf(dir, sizeof dir, "%.*s", (int)MAX(p - watchfile, 1), watchfile);
+		watchname = p + 1;
+	}
+	else {
+		strcpy(dir, ".");
+		watchname = watchfile;
+	}
+	/* watch the directory, editors replace files rather than write them */
+	if((watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1
+	|| inotify_add_watch(watchfd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) == -1)
+		eprintf("cannot watch '%s':", dir);
+#endif
+}
+
+/* reload watchfile if the events on watchfd concern it, True if the items
+ * changed */
+Bool
+watchpoll(void) {
+#ifdef WATCH
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	size_t old = menuitems(menu), removed;
+	ssize_t n;
+	char *p;
+	Bool hit = False;
+
+	while((n = read(watchfd, buf, sizeof buf)) > 0)
+		for(p = buf; p < buf + n; p += sizeof *ev + ev->len) {
+			ev = (const struct inotify_event *)p;
+			hit |= (ev->len > 0 && !strcmp(ev->name, watchname));
+		}
+	if(!hit)
+		return False;
+	removed = watchreload();
+	if(menuitems(menu) == old && removed == 0)
+		return False;
+	itemschanged();
+	/* an often edited file leaves more items removed than live */
+	if(menudead(menu) > menuitems(menu) - menudead(menu))
+		watchcompact();
+	return True;
+#else
+	return False;
+#endif
+}
+
+/* diff watchfile against the items read from it before: lines still there
+ * keep their items, new lines are added and items whose line went away are
+ * removed.  Returns how many were.  Lines are first compared with the item
+ * that followed the last one found, so unchanged runs cost a strcmp() each
+ * and only changed lines are hashed. */
+size_t
+watchreload(void) {
+	char *buf, *p, *q, *end;
+	size_t size = ARENA_BLOCK, len = 0, i, k = 0, m = 0, removed = 0;
+	unsigned int *order, it;
+	ssize_t n;
+	uint64_t h;
+	int fd = open(watchfile, O_RDONLY);
+	Bool eof = (fd == -1);
+
+	if(!(buf = malloc(size))
+	|| !(order = malloc((watchordersize = MAX(watchn, 1024)) * sizeof *order)))
+		eprintf("cannot malloc %u bytes:", size);
+	watchgen++;
+	/* a block at a time, the buffer stays in cache */
+	for(;;) {
+		if(!eof) {
+			while((n = read(fd, buf + len, size - len - 1)) == -1 && errno == EINTR);
+			if(n > 0)
+				len += n;
+			else {
+				eof = True;
+				if(len > 0) /* last line without delimiter */
+					buf[len++] = delim;
+			}
+		}
+		for(p = buf, end = buf + len; (q = memchr(p, delim, end - p)); p = q + 1) {
+			*q = '\0';
+			it = WATCH_EMPTY;
+			if(k < watchn && watchseen[watchorder[k]] != watchgen && !strcmp(menuitem(menu, watchorder[k]), p))
+				it = watchorder[k];
+			else if(watchsize > 0) {
+				/* claim an item with the same text this reload has not seen yet */
+				h = watchhash(p);
+				for(i = h & (watchsize - 1); watched[i].item != WATCH_EMPTY; i = (i + 1) & (watchsize - 1))
+					if(watched[i].item < WATCH_GONE && watched[i].hash == h
+					&& watchseen[watched[i].item] != watchgen && !strcmp(menuitem(menu, watched[i].item), p)) {
+						it = watched[i].item;
+						break;
+					}
+			}
+			if(it != WATCH_EMPTY)
+				k = watchpos[it] + 1;
+			else {
+				menuadd(menu, p, q - p, 0);
+				it = menuitems(menu) - 1;
+				watchadd(watchhash(p), it);
+				if(menuitems(menu) > watchitems) {
+					watchitems = MAX(2 * watchitems, menuitems(menu));
+					if(!(watchpos = realloc(watchpos, watchitems * sizeof *watchpos))
+					|| !(watchseen = realloc(watchseen, watchitems * sizeof *watchseen)))
+						eprintf("cannot realloc %u bytes:", watchitems * sizeof *watchseen);
+				}
+			}
+			watchseen[it] = watchgen;
+			if(m == watchordersize && !(order = realloc(order, (watchordersize *= 2) * sizeof *order)))
+				eprintf("cannot realloc %u bytes:", watchordersize * sizeof *order);
+			order[m++] = it;
+		}
+		memmove(buf, p, len = end - p);
+		if(eof)
+			break;
+		if(len == size - 1 && !(buf = realloc(buf, size *= 2)))
+			eprintf("cannot realloc %u bytes:", size);
+	}
+	if(fd != -1)
+		close(fd);
+	free(buf);
+	for(k = 0; k < watchn; k++) {
+		if(watchseen[it = watchorder[k]] == watchgen)
+			continue;
+		for(i = watchhash(menuitem(menu, it)) & (watchsize - 1); watched[i].item != it; i = (i + 1) & (watchsize - 1));
+		watched[i].item = WATCH_GONE;
+		watchlive--;
+		menuremove(menu, it);
+		removed++;
+	}
+	free(watchorder);
+	watchorder = order;
+	for(watchn = m, k = 0; k < m; k++)
+		watchpos[order[k]] = k;
+	return removed;
+}
@@ -1,17 +1,57 @@
 /* See LICENSE file for copyright and license details. */
 #include <locale.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <X11/Xlib.h>
+#ifdef XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
 #include "draw.h"
 
 #define MAX(a, b)  ((a) > (b) ? (a) : (b))
 #define MIN(a, b)  ((a) < (b) ? (a) : (b))
+#define BLEND(f, b, a, s)  (((((f) >> (s) & 0xff) * (a) + ((b) >> (s) & 0xff) * (255 - (a))) / 255) << (s))
+
+#ifdef XSHM
+typedef struct {
+	FT_UInt index;       /* glyph index plus one, 0 if the slot is empty */
+	int left, top, adv;
+	int w, h;
+	unsigned char *bits; /* w * h coverage values */
+} GlyphBits;
+
+static void shmbegin(DC *dc);
+static void shmfill(DC *dc, int x, int y, int w, int h, unsigned long color);
+static void shmfree(DC *dc);
+static GlyphBits *shmglyph(DC *dc, FT_UInt index);
+static Bool shmresize(DC *dc, unsigned int w, unsigned int h);
+static void shmtext(DC *dc, const char *text, size_t n, ColorSet *col);
+
+static GlyphBits glyphs[256]; /* rendered glyphs, direct mapped by index */
+static Bool shmfailed;
+#endif
 
 void
 drawrect(DC *dc, int x, int y, unsigned int w, unsigned int h, Bool fill, unsigned long color) {
+#ifdef XSHM
+	if(dc->shm.img[0]) {
+		x += dc->x;
+		y += dc->y;
+		if(fill)
+			shmfill(dc, x, y, w, h, color);
+		else {
+			shmfill(dc, x, y, w, 1, color);
+			shmfill(dc, x, y + h - 1, w, 1, color);
+			shmfill(dc, x, y, 1, h, color);
+			shmfill(dc, x + w - 1, y, 1, h, color);
+		}
+		return;
+	}
+#endif
 	XSetForeground(dc->dpy, dc->gc, color);
 	if(fill)
 		XFillRectangle(dc->dpy, dc->canvas, dc->gc, dc->x + x, dc->y + y, w, h);
@@ -21,19 +61,27 @@ drawrect(DC *dc, int x, int y, unsigned int w, unsigned int h, Bool fill, unsign
 
 void
 drawtext(DC *dc, const char *text, ColorSet *col) {
-	char buf[BUFSIZ];
 	size_t mn, n = strlen(text);
+	int x;
 
 	/* shorten text if necessary */
-	for(mn = MIN(n, sizeof buf); textnw(dc, text, mn) + dc->font.height/2 > dc->w; mn--)
+	for(mn = MIN(n, BUFSIZ); textnw(dc, text, mn) + dc->font.height/2 > dc->w; mn--)
 		if(mn == 0)
 			return;
-	memcpy(buf, text, mn);
-	if(mn < n)
-		for(n = MAX(mn-3, 0); n < mn; buf[n++] = '.');
 
 	drawrect(dc, 0, 0, dc->w, dc->h, True, col->BG);
-	drawtextn(dc, buf, mn, col);
+	if(mn == n) {
+		drawtextn(dc, text, n, col);
+		return;
+	}
+	/* the last three bytes that fit become dots, drawn after the rest
+	 * rather than copying the text to put them in */
+	n = mn > 3 ? mn - 3 : 0;
+	drawtextn(dc, text, n, col);
+	x = dc->x;
+	dc->x += textnw(dc, text, n);
+	drawtextn(dc, "...", mn - n, col);
+	dc->x = x;
 }
 
 void
@@ -41,6 +89,12 @@ drawtextn(DC *dc, const char *text, size_t n, ColorSet *col) {
 	int x = dc->x + dc->font.height/2;
 	int y = dc->y + dc->font.ascent + (dc->h - dc->font.height)/2;
 
+#ifdef XSHM
+	if(dc->shm.img[0]) {
+		shmtext(dc, text, n, col);
+		return;
+	}
+#endif
 	XSetForeground(dc->dpy, dc->gc, col->FG);
 	if(dc->font.xft_font) {
 		if (!dc->xftdraw)
@@ -55,6 +109,22 @@ drawtextn(DC *dc, const char *text, size_t n, ColorSet *col) {
 	}
 }
 
+/* handle events that belong to the draw context, return True if ev was one */
+Bool
+dcevent(DC *dc, XEvent *ev) {
+#ifdef XSHM
+	int i;
+
+	if(dc->shm.completion && ev->type == dc->shm.completion) {
+		for(i = 0; i < 2; i++)
+			if(dc->shm.busy[i] && ((XShmCompletionEvent *)ev)->shmseg == dc->shm.info[i].shmseg)
+				dc->shm.busy[i]--;
+		return True;
+	}
+#endif
+	return False;
+}
+
 void
 eprintf(const char *fmt, ...) {
 	va_list ap;
@@ -82,9 +152,17 @@ freecol(DC *dc, ColorSet *col) {
 
 void
 freedc(DC *dc) {
+#ifdef XSHM
+    int i;
+
+    shmfree(dc);
+    for(i = 0; i < 256; i++)
+        free(glyphs[i].bits);
+#endif
     if(dc->font.xft_font) {
         XftFontClose(dc->dpy, dc->font.xft_font);
-        XftDrawDestroy(dc->xftdraw);
+        if(dc->xftdraw)
+            XftDrawDestroy(dc->xftdraw);
     }
 	if(dc->font.set)
 		XFreeFontSet(dc->dpy, dc->font.set);
@@ -171,14 +249,56 @@ initfont(DC *dc, const char *fontstr) {
 	return;
 }
 
+/* compose frames client side in MIT-SHM images, needs an Xft font and a
+ * 32-bit TrueColor visual, return False if that is not possible */
+Bool
+initshm(DC *dc) {
+#ifdef XSHM
+	int screen = DefaultScreen(dc->dpy);
+	Visual *vis = DefaultVisual(dc->dpy, screen);
+
+	if(!dc->font.xft_font || !XShmQueryExtension(dc->dpy) || vis->class != TrueColor
+	|| vis->red_mask != 0xff0000 || vis->green_mask != 0xff00 || vis->blue_mask != 0xff)
+		return False;
+	dc->shm.completion = XShmGetEventBase(dc->dpy) + ShmCompletion;
+	return True;
+#else
+	return False;
+#endif
+}
+
 void
 mapdc(DC *dc, Window win, unsigned int w, unsigned int h) {
+#ifdef XSHM
+	int b;
+
+	if(dc->shm.img[0]) {
+		/* present the new frame, or the last one again on expose */
+		b = dc->shm.dirty ? dc->shm.back : !dc->shm.back;
+		XShmPutImage(dc->dpy, win, dc->gc, dc->shm.img[b], 0, 0, 0, 0, w, h, True);
+		dc->shm.busy[b]++;
+		if(dc->shm.dirty) {
+			dc->shm.back = !b;
+			dc->shm.dirty = False;
+		}
+		XFlush(dc->dpy);
+		return;
+	}
+#endif
 	XCopyArea(dc->dpy, dc->canvas, win, dc->gc, 0, 0, w, h, 0, 0);
 }
 
 void
 resizedc(DC *dc, unsigned int w, unsigned int h) {
 	int screen = DefaultScreen(dc->dpy);
+
+#ifdef XSHM
+	if(dc->shm.completion && shmresize(dc, w, h)) {
+		dc->w = w;
+		dc->h = h;
+		return;
+	}
+#endif
 	if(dc->canvas)
 		XFreePixmap(dc->dpy, dc->canvas);
 
@@ -193,6 +313,180 @@ resizedc(DC *dc, unsigned int w, unsigned int h) {
 	}
 }
 
+#ifdef XSHM
+static Bool
+isshmdone(Display *dpy, XEvent *ev, XPointer arg) {
+	return ev->type == ((DC *)arg)->shm.completion;
+}
+
+static int
+shmerror(Display *dpy, XErrorEvent *ee) {
+	shmfailed = True;
+	return 0;
+}
+
+/* start drawing a frame into the back image */
+void
+shmbegin(DC *dc) {
+	XEvent ev;
+
+	if(dc->shm.dirty)
+		return;
+	/* the server may still be reading the image we are about to overwrite */
+	while(dc->shm.busy[dc->shm.back]) {
+		XIfEvent(dc->dpy, &ev, isshmdone, (XPointer)dc);
+		dcevent(dc, &ev);
+	}
+	dc->shm.dirty = True;
+}
+
+void
+shmfill(DC *dc, int x, int y, int w, int h, unsigned long color) {
+	XImage *img;
+	uint32_t *p;
+	int i;
+
+	shmbegin(dc);
+	img = dc->shm.img[dc->shm.back];
+	w = MIN(x + w, img->width) - MAX(x, 0);
+	h = MIN(y + h, img->height) - MAX(y, 0);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	for(; h > 0; h--, y++)
+		for(p = (uint32_t *)(img->data + y * img->bytes_per_line) + x, i = 0; i < w; i++)
+			p[i] = color;
+}
+
+void
+shmfree(DC *dc) {
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		if(!dc->shm.img[i])
+			continue;
+		if(dc->shm.img[i]->data) {
+			XShmDetach(dc->dpy, &dc->shm.info[i]);
+			XSync(dc->dpy, False);
+			shmdt(dc->shm.info[i].shmaddr);
+			dc->shm.img[i]->data = NULL;
+		}
+		XDestroyImage(dc->shm.img[i]);
+		dc->shm.img[i] = NULL;
+		dc->shm.busy[i] = 0;
+	}
+}
+
+GlyphBits *
+shmglyph(DC *dc, FT_UInt index) {
+	GlyphBits *g = &glyphs[index % 256];
+	FT_Face face;
+	FT_Bitmap *bm;
+	unsigned char *row;
+	int x, y;
+
+	if(g->index == index + 1)
+		return g;
+	if(!(face = XftLockFace(dc->font.xft_font)))
+		return NULL;
+	if(FT_Load_Glyph(face, index, FT_LOAD_RENDER)) {
+		XftUnlockFace(dc->font.xft_font);
+		return NULL;
+	}
+	bm = &face->glyph->bitmap;
+	free(g->bits);
+	if(!(g->bits = malloc(bm->width * bm->rows + 1)))
+		eprintf("cannot malloc %u bytes\n", bm->width * bm->rows + 1);
+	for(y = 0; y < bm->rows; y++)
+		for(row = bm->buffer + y * bm->pitch, x = 0; x < bm->width; x++)
+			g->bits[y * bm->width + x] = (bm->pixel_mode == FT_PIXEL_MODE_MONO)
+				? ((row[x >> 3] >> (7 - (x & 7))) & 1) * 255 : row[x];
+	g->w = bm->width;
+	g->h = bm->rows;
+	g->left = face->glyph->bitmap_left;
+	g->top = face->glyph->bitmap_top;
+	g->adv = (face->glyph->advance.x + 32) >> 6;
+	g->index = index + 1;
+	XftUnlockFace(dc->font.xft_font);
+	return g;
+}
+
+Bool
+shmresize(DC *dc, unsigned int w, unsigned int h) {
+	int i, screen = DefaultScreen(dc->dpy);
+	int (*handler)(Display *, XErrorEvent *);
+	XShmSegmentInfo *info;
+	XImage *img;
+
+	shmfree(dc);
+	/* attaching fails on remote displays, catch that and fall back */
+	shmfailed = False;
+	handler = XSetErrorHandler(shmerror);
+	for(i = 0; i < 2; i++) {
+		info = &dc->shm.info[i];
+		if(!(img = dc->shm.img[i] = XShmCreateImage(dc->dpy, DefaultVisual(dc->dpy, screen),
+		       DefaultDepth(dc->dpy, screen), ZPixmap, NULL, info, w, h)))
+			break;
+		if(img->bits_per_pixel != 32
+		|| (info->shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT | 0600)) == -1)
+			break;
+		if((info->shmaddr = img->data = shmat(info->shmid, NULL, 0)) == (char *)-1) {
+			img->data = NULL;
+			shmctl(info->shmid, IPC_RMID, NULL);
+			break;
+		}
+		info->readOnly = True;
+		XShmAttach(dc->dpy, info);
+		XSync(dc->dpy, False);
+		/* the segment goes away once both of us have detached */
+		shmctl(info->shmid, IPC_RMID, NULL);
+		if(shmfailed)
+			break;
+	}
+	if(i < 2) {
+		shmfree(dc);
+		dc->shm.completion = 0;
+	}
+	XSetErrorHandler(handler);
+	dc->shm.back = 0;
+	dc->shm.dirty = False;
+	return i == 2;
+}
+
+void
+shmtext(DC *dc, const char *text, size_t n, ColorSet *col) {
+	XImage *img;
+	GlyphBits *g;
+	FcChar32 ucs;
+	uint32_t *p, fg = col->FG;
+	int i, len, x, y, gx, gy, px, py;
+	unsigned int a;
+
+	shmbegin(dc);
+	img = dc->shm.img[dc->shm.back];
+	x = dc->x + dc->font.height/2;
+	y = dc->y + dc->font.ascent + (dc->h - dc->font.height)/2;
+	for(i = 0; i < n; i += len) {
+		if((len = FcUtf8ToUcs4((const FcChar8 *)text + i, &ucs, n - i)) <= 0)
+			break;
+		if(!(g = shmglyph(dc, XftCharIndex(dc->dpy, dc->font.xft_font, ucs))))
+			continue;
+		for(gy = 0; gy < g->h; gy++) {
+			if((py = y - g->top + gy) < 0 || py >= img->height)
+				continue;
+			p = (uint32_t *)(img->data + py * img->bytes_per_line);
+			for(gx = 0; gx < g->w; gx++) {
+				px = x + g->left + gx;
+				if(px < 0 || px >= img->width || !(a = g->bits[gy * g->w + gx]))
+					continue;
+				p[px] = (a == 255) ? fg
+				      : BLEND(fg, p[px], a, 16) | BLEND(fg, p[px], a, 8) | BLEND(fg, p[px], a, 0);
+			}
+		}
+		x += g->adv;
+	}
+}
+#endif
+
 int
 textnw(DC *dc, const char *text, size_t len) {
 	if(dc->font.xft_font) {
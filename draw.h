@@ -1,6 +1,9 @@
 /* See LICENSE file for copyright and license details. */
 
 #include <X11/Xft/Xft.h>
+#ifdef XSHM
+#include <X11/extensions/XShm.h>
+#endif
 
 typedef struct {
 	int x, y, w, h;
@@ -18,6 +21,16 @@ typedef struct {
 		XFontStruct *xfont;
 		XftFont *xft_font;
 	} font;
+#ifdef XSHM
+	struct {
+		XImage *img[2];          /* frames are composed client side */
+		XShmSegmentInfo info[2];
+		Bool busy[2];            /* server has not finished reading it */
+		int back;                /* image the next frame is drawn into */
+		Bool dirty;              /* back holds a frame not yet presented */
+		int completion;          /* ShmCompletion event type */
+	} shm;
+#endif
 } DC;  /* draw context */
 
 typedef struct {
@@ -32,10 +45,12 @@ void drawtextn(DC *dc, const char *text, size_t n, ColorSet *col);
 void freecol(DC *dc, ColorSet *col);
 void eprintf(const char *fmt, ...);
 void freedc(DC *dc);
+Bool dcevent(DC *dc, XEvent *ev);
 unsigned long getcolor(DC *dc, const char *colstr);
 ColorSet *initcolor(DC *dc, const char *foreground, const char *background);
 DC *initdc(void);
 void initfont(DC *dc, const char *fontstr);
+Bool initshm(DC *dc);
 void mapdc(DC *dc, Window win, unsigned int w, unsigned int h);
 void resizedc(DC *dc, unsigned int w, unsigned int h);
 int textnw(DC *dc, const char *text, size_t len);
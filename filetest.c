@@ -0,0 +1,26 @@
+/* See LICENSE file for copyright and license details. */
+#include <unistd.h>
+#include "filetest.h"
+
+int
+filetest(const FileTest *t, const char *path, const char *name) {
+	struct stat st, ln;
+
+	return (FLAG(t, 'a') || name[0] != '.')                          /* hidden files      */
+	&& !stat(path, &st)
+	&& (!FLAG(t, 'b') || S_ISBLK(st.st_mode))                        /* block special     */
+	&& (!FLAG(t, 'c') || S_ISCHR(st.st_mode))                        /* character special */
+	&& (!FLAG(t, 'd') || S_ISDIR(st.st_mode))                        /* directory         */
+	&& (!FLAG(t, 'e') || access(path, F_OK) == 0)                    /* exists            */
+	&& (!FLAG(t, 'f') || S_ISREG(st.st_mode))                        /* regular file      */
+	&& (!FLAG(t, 'g') || st.st_mode & S_ISGID)                       /* set-group-id flag */
+	&& (!FLAG(t, 'h') || (!lstat(path, &ln) && S_ISLNK(ln.st_mode))) /* symbolic link     */
+	&& (!FLAG(t, 'n') || st.st_mtime > t->new.st_mtime)              /* newer than file   */
+	&& (!FLAG(t, 'o') || st.st_mtime < t->old.st_mtime)              /* older than file   */
+	&& (!FLAG(t, 'p') || S_ISFIFO(st.st_mode))                       /* named pipe        */
+	&& (!FLAG(t, 'r') || access(path, R_OK) == 0)                    /* readable          */
+	&& (!FLAG(t, 's') || st.st_size > 0)                             /* not empty         */
+	&& (!FLAG(t, 'u') || st.st_mode & S_ISUID)                       /* set-user-id flag  */
+	&& (!FLAG(t, 'w') || access(path, W_OK) == 0)                    /* writable          */
+	&& (!FLAG(t, 'x') || access(path, X_OK) == 0);                   /* executable        */
+}
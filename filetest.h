@@ -0,0 +1,16 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * The file tests of stest, which dmenu -list applies to what it lists. */
+
+#include <sys/stat.h>
+
+#define FLAG(t, x) ((t)->flag[(x)-'a'])
+
+typedef struct {
+	int flag[26];         /* one for each option of stest */
+	struct stat old, new; /* the files of -o and -n */
+} FileTest;
+
+/* whether the file at path, name in the directory it was listed from, passes
+ * every test flagged in t */
+int filetest(const FileTest *t, const char *path, const char *name);
@@ -0,0 +1,412 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * latency measures dmenu from a key press to the pixels on screen.  It
+ * starts an Xvfb server unless -d names one, generates a corpus, runs dmenu
+ * on it and types a key script through XTest.  A frame is done when the
+ * damage it causes on the screen settles.  With -A it preloads allocs.so
+ * and fails if typing the script a second time allocates. */
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <X11/extensions/Xdamage.h>
+
+#define LENGTH(X)   (sizeof (X) / sizeof *(X))
+#define MAX(a,b)    ((a) > (b) ? (a) : (b))
+#define MAXSIZES    8
+#define MAXMODES    16
+#define MAXSAMPLES  (1 << 16)
+#define SETTLE      5     /* ms without damage that end a frame */
+#define TIMEOUT     1000  /* ms to wait for a frame */
+
+static unsigned long allocs(void);
+static int dblcmp(const void *a, const void *b);
+static void die(const char *fmt, ...);
+static int frame(double *t, int timeout);
+static void measure(const char *mode, size_t n);
+static int mkcorpus(size_t n);
+static double now(void);
+static double percentile(double *v, size_t n, double q);
+static void sigexit(int sig);
+static void spawn(const char *mode, int in);
+static void startxvfb(void);
+static void stopall(void);
+static KeySym tokeysym(char c);
+static void typekeys(size_t *nl);
+
+static const char *dmenu = "./dmenu";
+static const char *allocslib = NULL;
+static char allocsfile[] = "/tmp/allocsXXXXXX";
+static int leaks = 0;  /* configurations that allocate in steady state */
+static const char *keys = "usr/bin^^^^^^^>>>]]";  /* ^ BackSpace, > Down, ] Next */
+static const char *modes[MAXMODES];
+static size_t sizes[MAXSIZES];
+static int nmodes = 0, nsizes = 0, runs = 5;
+static Display *dpy;
+static Window root;
+static Damage damage;
+static int damageev, err;
+static pid_t xvfb = -1, child = -1;
+static double startup[MAXSAMPLES], lat[MAXSAMPLES];
+
+int
+main(int argc, char *argv[]) {
+	const char *display = NULL;
+	int i, j, opt;
+
+	while((opt = getopt(argc, argv, "A:b:d:k:m:n:r:")) != -1)
+		switch(opt) {
+		case 'A': allocslib = optarg; break;
+		case 'b': dmenu = optarg; break;
+		case 'd': display = optarg; break;
+		case 'k': keys = optarg; break;
+		case 'r': runs = atoi(optarg); break;
+		case 'm':
+			if(nmodes < MAXMODES)
+				modes[nmodes++] = optarg;
+			break;
+		case 'n':
+			if(nsizes < MAXSIZES)
+				sizes[nsizes++] = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-A allocs.so] [-b dmenu] [-d display] [-k keys] [-m mode]...\n"
+			        "       [-n items]... [-r runs]\n", argv[0]);
+			exit(2);
+		}
+	if(runs < 1 || runs * strlen(keys) > MAXSAMPLES)
+		die("bad number of runs\n");
+	if(nmodes == 0) {
+		modes[nmodes++] = "";
+		modes[nmodes++] = "-i";
+		modes[nmodes++] = "-z";
+		modes[nmodes++] = "-t";
+		modes[nmodes++] = "-l 20";
+	}
+	if(nsizes == 0) {
+		sizes[nsizes++] = 1000;
+		sizes[nsizes++] = 100000;
+		sizes[nsizes++] = 1000000;
+	}
+	if(allocslib) {
+		if((i = mkstemp(allocsfile)) == -1)
+			die("cannot create %s\n", allocsfile);
+		close(i);
+	}
+	atexit(stopall);
+	signal(SIGINT, sigexit);
+	signal(SIGTERM, sigexit);
+
+	if(display)
+		setenv("DISPLAY", display, 1);
+	else
+		startxvfb();
+	if(!(dpy = XOpenDisplay(NULL)))
+		die("cannot open display\n");
+	if(!XTestQueryExtension(dpy, &i, &j, &i, &j))
+		die("no XTest extension\n");
+	if(!XDamageQueryExtension(dpy, &damageev, &err))
+		die("no DAMAGE extension\n");
+	root = DefaultRootWindow(dpy);
+	XSelectInput(dpy, root, SubstructureNotifyMask);
+	damage = XDamageCreate(dpy, root, XDamageReportNonEmpty);
+
+	printf("%-10s %9s %9s %7s %8s %8s %8s%s\n", "mode", "items", "start/ms",
+	       "keys", "p50/ms", "p95/ms", "p99/ms", allocslib ? "   allocs" : "");
+	for(i = 0; i < nsizes; i++)
+		for(j = 0; j < nmodes; j++)
+			measure(modes[j], sizes[i]);
+	return leaks ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* the allocations of dmenu so far, which allocs.so appends to allocsfile
+ * when it is sent SIGUSR2 */
+unsigned long
+allocs(void) {
+	static long seen = 0;
+	unsigned long n = 0;
+	char line[32];
+	FILE *fp;
+	long lines;
+	int i;
+
+	kill(child, SIGUSR2);
+	for(i = 0; i < 100; i++, usleep(10000)) {
+		if(!(fp = fopen(allocsfile, "r")))
+			continue;
+		for(lines = 0; fgets(line, sizeof line, fp); lines++)
+			n = strtoul(line, NULL, 10);
+		fclose(fp);
+		if(lines > seen) {
+			seen = lines;
+			return n;
+		}
+	}
+	die("%s does not report allocations\n", allocslib);
+	return 0;
+}
+
+void
+die(const char *fmt, ...) {
+	va_list ap;
+
+	fputs("latency: ", stderr);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(EXIT_FAILURE);
+}
+
+/* wait for damage to the screen and then for it to settle; the time of the
+ * last damage is the end of the frame */
+int
+frame(double *t, int timeout) {
+	struct pollfd pfd;
+	double deadline = now() + timeout;
+	XEvent ev;
+	int seen = 0, ms;
+
+	pfd.fd = ConnectionNumber(dpy);
+	pfd.events = POLLIN;
+	for(;;) {
+		while(XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			if(ev.type == damageev + XDamageNotify) {
+				XDamageSubtract(dpy, damage, None, None);
+				*t = now();
+				seen = 1;
+			}
+		}
+		ms = seen ? (int)(*t + SETTLE - now()) : (int)(deadline - now());
+		if(ms <= 0)
+			return seen;
+		if(poll(&pfd, 1, ms) == 0 && seen)
+			return 1;
+	}
+}
+
+/* one line of the report: runs start-ups of dmenu in mode on n items, each
+ * followed by the key script */
+void
+measure(const char *mode, size_t n) {
+	double t0, t;
+	size_t ns = 0, nl = 0;
+	unsigned long a, steady = 0;
+	KeyCode kc;
+	int i, in, r;
+
+	in = mkcorpus(n);
+	for(r = 0; r < runs; r++) {
+		XSync(dpy, False);
+		frame(&t, 0);
+		lseek(in, 0, SEEK_SET);
+		t0 = now();
+		spawn(mode, in);
+		if(!frame(&t, TIMEOUT * 10))
+			die("dmenu %s shows nothing\n", mode);
+		startup[ns++] = t - t0;
+
+		typekeys(&nl);
+		if(allocslib) {
+			/* by now every buffer has grown, the same keys again
+			 * should not need more */
+			a = allocs();
+			typekeys(NULL);
+			steady = MAX(steady, allocs() - a);
+		}
+		kc = XKeysymToKeycode(dpy, XK_Escape);
+		XTestFakeKeyEvent(dpy, kc, True, CurrentTime);
+		XTestFakeKeyEvent(dpy, kc, False, CurrentTime);
+		XFlush(dpy);
+		for(i = 0; i < 100 && waitpid(child, NULL, WNOHANG) == 0; i++)
+			usleep(20000);
+		if(i == 100) {
+			kill(child, SIGKILL);
+			waitpid(child, NULL, 0);
+		}
+		child = -1;
+	}
+	close(in);
+	printf("%-10s %9zu %9.2f %7zu %8.2f %8.2f %8.2f", *mode ? mode : "default", n,
+	       percentile(startup, ns, 0.5), nl, percentile(lat, nl, 0.5),
+	       percentile(lat, nl, 0.95), percentile(lat, nl, 0.99));
+	if(allocslib)
+		printf(" %8lu", steady);
+	putchar('\n');
+	fflush(stdout);
+	leaks += (steady > 0);
+}
+
+/* n made-up paths, the same for every run, in an unlinked file */
+int
+mkcorpus(size_t n) {
+	static const char *dirs[] = { "bin", "lib", "share", "include", "src", "etc", "doc", "local" };
+	static const char *words[] = { "python", "gtk", "xorg", "font", "perl", "icons", "locale",
+	                               "systemd", "man", "dbus", "qt", "zsh", "vim", "mesa" };
+	static const char *exts[] = { "", ".so", ".h", ".c", ".py", ".png", ".gz", ".conf" };
+	char path[] = "/tmp/latencyXXXXXX";
+	unsigned long x = 1;
+	size_t i;
+	FILE *fp;
+	int fd;
+
+	if((fd = mkstemp(path)) == -1 || !(fp = fdopen(dup(fd), "w")))
+		die("cannot create corpus\n");
+	unlink(path);
+	for(i = 0; i < n; i++) {
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+		fprintf(fp, "/usr/%s/%s%lu/%s-%lu%s\n", dirs[(x >> 33) % LENGTH(dirs)],
+		        words[(x >> 40) % LENGTH(words)], (x >> 20) % 10,
+		        words[(x >> 48) % LENGTH(words)], (x >> 24) % 1000, exts[(x >> 56) % LENGTH(exts)]);
+	}
+	if(fclose(fp) == EOF)
+		die("cannot write corpus\n");
+	return fd;
+}
+
+double
+now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int
+dblcmp(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+double
+percentile(double *v, size_t n, double q) {
+	if(n == 0)
+		return 0;
+	qsort(v, n, sizeof *v, dblcmp);
+	return v[(size_t)(q * (n - 1) + 0.5)];
+}
+
+/* run dmenu with the space separated options in mode, reading from in */
+void
+spawn(const char *mode, int in) {
+	char buf[BUFSIZ], *argv[64], *p;
+	int argc = 0;
+
+	snprintf(buf, sizeof buf, "%s", mode);
+	argv[argc++] = (char *)dmenu;
+	for(p = strtok(buf, " "); p && argc < (int)LENGTH(argv) - 1; p = strtok(NULL, " "))
+		argv[argc++] = p;
+	argv[argc] = NULL;
+	if((child = fork()) == -1)
+		die("cannot fork\n");
+	if(child == 0) {
+		if(allocslib) {
+			setenv("LD_PRELOAD", allocslib, 1);
+			setenv("ALLOCS", allocsfile, 1);
+		}
+		dup2(in, STDIN_FILENO);
+		close(ConnectionNumber(dpy));
+		freopen("/dev/null", "w", stdout);
+		execvp(dmenu, argv);
+		fprintf(stderr, "latency: cannot run %s\n", dmenu);
+		_exit(127);
+	}
+}
+
+/* a private server on the first free display from :90 on */
+void
+startxvfb(void) {
+	char display[16], lock[32];
+	Display *d;
+	int i;
+
+	for(i = 90; i < 200; i++) {
+		snprintf(lock, sizeof lock, "/tmp/.X%d-lock", i);
+		if(access(lock, F_OK) == -1)
+			break;
+	}
+	snprintf(display, sizeof display, ":%d", i);
+	if((xvfb = fork()) == -1)
+		die("cannot fork\n");
+	if(xvfb == 0) {
+		freopen("/dev/null", "w", stderr);
+		execlp("Xvfb", "Xvfb", display, "-screen", "0", "1280x800x24", "-nolisten", "tcp", NULL);
+		_exit(127);
+	}
+	setenv("DISPLAY", display, 1);
+	for(i = 0; i < 100; i++) {
+		if((d = XOpenDisplay(NULL))) {
+			XCloseDisplay(d);
+			return;
+		}
+		if(waitpid(xvfb, NULL, WNOHANG) == xvfb) {
+			xvfb = -1;
+			die("cannot start Xvfb\n");
+		}
+		usleep(50000);
+	}
+	die("Xvfb did not come up on %s\n", display);
+}
+
+void
+sigexit(int sig) {
+	stopall();
+	_exit(EXIT_FAILURE);
+}
+
+void
+stopall(void) {
+	if(allocslib)
+		unlink(allocsfile);
+	if(child > 0)
+		kill(child, SIGTERM);
+	if(xvfb > 0) {
+		kill(xvfb, SIGTERM);
+		waitpid(xvfb, NULL, 0);
+	}
+}
+
+KeySym
+tokeysym(char c) {
+	char s[2] = { c, '\0' };
+
+	switch(c) {
+	case '^': return XK_BackSpace;
+	case '>': return XK_Down;
+	case ']': return XK_Next;
+	case '/': return XK_slash;
+	case '.': return XK_period;
+	case '-': return XK_minus;
+	case ' ': return XK_space;
+	default:  return XStringToKeysym(s);
+	}
+}
+
+/* type the key script, timing each key into lat unless nl is NULL */
+void
+typekeys(size_t *nl) {
+	const char *k;
+	KeyCode kc;
+	double t0, t;
+
+	for(k = keys; *k; k++) {
+		if(!(kc = XKeysymToKeycode(dpy, tokeysym(*k))))
+			die("no key for '%c'\n", *k);
+		t0 = now();
+		XTestFakeKeyEvent(dpy, kc, True, CurrentTime);
+		XTestFakeKeyEvent(dpy, kc, False, CurrentTime);
+		XFlush(dpy);
+		/* keys that change nothing, like Down on the last item, draw nothing */
+		if(frame(&t, TIMEOUT) && nl)
+			lat[(*nl)++] = t - t0;
+	}
+}
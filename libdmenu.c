@@ -0,0 +1,2109 @@
+/* See LICENSE file for copyright and license details. */
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libdmenu.h"
+
+#define MIN(a,b)              ((a) < (b) ? (a) : (b))
+#define MAX(a,b)              ((a) > (b) ? (a) : (b))
+#define ARENA_BLOCK (1 << 20) /* bytes of input read into one arena block */
+#define MATCH_CHUNK 32768 /* items scanned between checks for a newer query */
+#define FIRST_SLICE 1024  /* items scanned before the first page may be settled */
+#define CACHE_SIZE 32           /* recent query results kept for backspace */
+#define CACHE_BUDGET (64 << 20) /* bytes of match indices they may hold */
+#define PLAN_HISTORY 64 /* clauses whose hit rates a query remembers */
+#define PLAN_BUDGET 2e6 /* ns a query may take on the calling thread */
+#define PLAN_LOG 16     /* recent plans menustats() shows */
+#define LEARN_SLOTS 8192 /* (prefix, item) pairs menulearn() remembers */
+#define LEARN_PROBE 16   /* slots the pairs of one prefix are kept within */
+#define LEARN_PREFIX 16  /* longest prefix learned */
+#define LEARN_MIN 2      /* picks before an item is preselected */
+#define LEARN_AGE 168    /* hours after which a pick counts half */
+#define LEARN_MAGIC 0x726c6d64 /* "dmlr" */
+#define SIG_LIVE ((uint64_t)1 << 63) /* in every signature, items lose it when removed */
+#define INDEX_EMPTY UINT_MAX         /* free slot in the item index */
+#define SEG_SHIFT 20    /* bits of a text handle that are an offset into its segment */
+#define SEG_ITEMS 1024  /* items whose handles count segments from one base */
+#define SEG_RECENT 16   /* latest segments a new text is looked for in */
+/* these expect the item arrays of the menu in locals of the same name */
+#define SEGTEXT(i, h)         ((const char *)(segs[segbase[(i) / SEG_ITEMS] + ((h) >> SEG_SHIFT)] + ((h) & ((1 << SEG_SHIFT) - 1))))
+#define ITEMTEXT(fold, i)     SEGTEXT(i, (fold) ? foldref[(i)] : textref[(i)])
+#define MATCHTEXT(i)          ITEMTEXT(foldcase, i)
+/* run kernel k specialised for the case mode and whether q has an automaton */
+#define KERNEL(k, q, i, end, n) ((q)->m->foldcase \
+	? ((q)->nstates ? k(q, i, end, n, True, True) : k(q, i, end, n, True, False)) \
+	: ((q)->nstates ? k(q, i, end, n, False, True) : k(q, i, end, n, False, False)))
+#define INLINE                inline __attribute__((always_inline))
+/* rank of candidate i, items of earlier sources go first within a tier */
+#define SORTKEY(m, i)         ((m)->nsrcs > 1 ? (m)->matchtier[(i)] * (m)->nsrcs \
+                               + (m)->srcs[(m)->matchbuf[(i)]] : (m)->matchtier[(i)])
+
+typedef int Bool;
+enum { False, True };
+
+typedef struct {
+	char *buf;    /* arena block items are read into */
+	size_t size;  /* capacity of buf */
+	size_t len;   /* bytes read into buf */
+	size_t start; /* offset of the line being read */
+} Reader;
+
+typedef struct {
+	char *p;
+	size_t size;
+	Bool spilled; /* lives in the spill file */
+} Block;
+
+typedef struct {
+	char *text;         /* query */
+	unsigned int *v;    /* its matches in display order */
+	size_t textsize, vsize; /* room kept for reuse when the slot is free */
+	size_t n, pos[2];
+	unsigned long used; /* 0 if the slot is free */
+} Cached;
+
+typedef struct {
+	uint64_t hash;         /* of the item text */
+	unsigned int item;     /* or INDEX_EMPTY */
+} Indexed;
+
+typedef struct {
+	uint64_t prefix, item; /* hashes of a query prefix and an item, 0 if free */
+	uint32_t count;        /* times the item was picked after the prefix */
+	uint32_t last;         /* hour it was last picked */
+} Learned;
+
+typedef struct {
+	uint32_t magic, version;
+	Learned slot[LEARN_SLOTS];
+} LearnFile;
+
+typedef struct {
+	uint64_t peq[256];     /* positions of each byte in the token */
+	uint64_t sig;
+	size_t len;
+	int maxerr;            /* edits allowed for this token */
+} Pattern;
+
+enum { TermSub, TermPrefix, TermSuffix, TermWhole, TermFuzzy }; /* term ops */
+enum { PlanCache, PlanRefine, PlanScan, PlanSliced }; /* how a query is matched */
+
+typedef struct {
+	char text[24];         /* query, cut short */
+	int plan;
+	size_t items;          /* scanned before the first page was shown */
+	double est, took;      /* ns */
+} Plan;
+
+typedef struct {
+	const char *s;
+	size_t len;
+	int op;
+	Bool neg;
+} Term;
+
+typedef struct {
+	int first, n;          /* alternative terms in termv */
+	int cost;              /* relative cost of testing all of them */
+	double prior;          /* guessed chance an item passes */
+	unsigned long key;     /* hash of the terms, to find earlier counts */
+	unsigned long tries, hits;
+} Clause;
+
+typedef struct {
+	Menu *m;               /* whose items it is matched against */
+	char text[2 * BUFSIZ]; /* query as typed, folding may grow it */
+	char buf[2 * BUFSIZ];  /* query split into tokens */
+	char *tokv[BUFSIZ];
+	int tokc;
+	size_t len;            /* length of the first token */
+	/* Aho-Corasick automaton over all tokens, the states fit in 16 bits */
+	unsigned short *delta; /* 256 transitions per state */
+	unsigned short *fail;  /* failure links, followed by a BFS queue */
+	uint64_t *out;         /* tokens recognised on entering a state */
+	uint64_t all;          /* out bits once every token was seen */
+	size_t nstates, statesize;
+	uint64_t sig;          /* characters every match must contain */
+	size_t rejected;       /* items ruled out by their signature */
+	Pattern *pat;          /* per token, for approximate matching */
+	size_t patsize;
+	regex_t re;            /* whole query, for regular expression matching */
+	Bool hasre;
+	Term *termv;           /* extended syntax: terms of all clauses */
+	Clause *clausev;       /* clauses in evaluation order */
+	int termc, clausec;
+	size_t termsize, clausesize;
+	int rank;              /* term the result is ranked by, -1 if none */
+	struct { unsigned long key, tries, hits; } seen[PLAN_HISTORY];
+} Query;
+
+/* Items are indices into arrays of their properties, which stay as they are
+ * while the items are matched.  Their text is addressed by 32-bit handles
+ * into segments, the upper bits pick a segment and the lower ones are an
+ * offset from its start.  Segments are counted from the base of each run of
+ * SEG_ITEMS items, which cannot open enough of them to run out of bits. */
+struct Menu {
+	uint32_t *textref;             /* handle of the text of each item */
+	unsigned char *srcs;           /* tag each item was added with */
+	size_t nitems, itemsize;
+	uintptr_t *segs;               /* start of each segment */
+	size_t nsegs, segsize;
+	size_t *segbase;               /* first segment of each run of items */
+	size_t nsegbase;
+	uint64_t *sigs;                /* character classes present in each item */
+	const char *maxstr;
+	size_t maxlen;
+	int nsrcs;                     /* highest tag added, plus one */
+	size_t fresh, removed;         /* first item not matched yet, items removed */
+	size_t dead;                   /* items removed and not compacted away */
+	Reader readers[MENU_SOURCES];
+	char *addbuf;                  /* arena block menuadd() copies into */
+	size_t addlen, addsize;
+	Bool foldcase;
+	uint32_t *foldref;             /* handle of the case folded shadow of each item, MenuFold only */
+	char *foldbuf;                 /* arena block they are folded into */
+	size_t foldlen, foldsize, foldn;
+	Block *blocks;                 /* all arena blocks, to free them */
+	size_t nblocks, blocksize;
+	size_t membudget;              /* bytes of item text kept on the heap */
+	size_t heapbytes;
+	int spillfd;                   /* item text past the budget */
+	off_t spilllen;
+
+	size_t (*matchfn)(Query *, size_t, size_t, size_t);
+	Bool fuzzyterms;               /* plain terms of extended queries are fuzzy */
+	int ntiers;                    /* ranks a matcher sorts its candidates into */
+	int maxerr;                    /* edits allowed by MenuApprox */
+	char text[BUFSIZ];             /* query */
+	size_t want;                   /* matches it should settle */
+	unsigned int *matches;         /* item indices in display order */
+	unsigned int *matchbuf;        /* candidates in item order */
+	unsigned char *matchtier;      /* rank of each candidate */
+	size_t nmatches;
+	size_t ncand;                  /* candidates in matchbuf */
+	size_t settled;                /* leading matches no later item can displace */
+	Bool candvalid;                /* they are all there are for text */
+	char candtext[BUFSIZ];         /* query the candidates were sought for */
+	Bool pending;                  /* the worker has the rest of the items */
+	unsigned int predicted;        /* learned pick shown first */
+	LearnFile *learn;
+	Indexed *itemindex;            /* items by text hash, for learning */
+	size_t itemindexsize;
+	Query query;
+	Cached cache[CACHE_SIZE];
+	Cached *cached;                /* entry the shown result came from */
+	size_t cachebytes;             /* room of all slots */
+	unsigned long cacheclock;
+	struct {
+		unsigned long queries, cachehits;
+		unsigned long long scanned, rejected, ns, spilled;
+		unsigned long plans[4];
+	} stats;
+	struct {
+		unsigned long long bytes;   /* of item text */
+		unsigned long lenhist[64];  /* items by the bit length of their length */
+		unsigned long sigcount[64]; /* items with each signature bit */
+		double nsitem, nscand;      /* cost of scanning an item, a candidate */
+	} corpus;
+	Plan planlog[PLAN_LOG];
+
+	pthread_t worker;
+	Query workq;                   /* the worker's compiled query */
+	pthread_mutex_t lock;          /* guards the rest, and stats and corpus */
+	pthread_cond_t workcond;
+	pthread_cond_t donecond;
+	unsigned long matchgen;        /* bumped for every new query */
+	unsigned long donegen;         /* query the published candidates belong to */
+	size_t donen, donescanned;
+	unsigned long workgen;         /* query handed to the worker */
+	char worktext[BUFSIZ];
+	size_t workstart, workn;       /* where the calling thread left off */
+	Bool workbusy;                 /* worker may be reading the items */
+	Bool quit;
+	int wakefd[2];
+};
+
+static void acbuild(Query *q);
+static Bool acmatch(const Query *q, const char *s);
+static void additem(Menu *m, const char *text, size_t len, int src);
+static char *blockalloc(Menu *m, size_t size);
+static void blockfree(Menu *m, char *p);
+static Cached *cacheget(Menu *m, const char *s);
+static void cacheput(Menu *m, const char *s);
+static void cacheclear(Menu *m);
+static double clauserank(const Clause *c);
+static Bool compile(Query *q, const char *s);
+static void die(const char *fmt, ...);
+static int editdist(const Pattern *p, const char *s);
+static char *fold(char *d, const char *s);
+static const char *foldadd(Menu *m, size_t i, const char *s, size_t len);
+static INLINE Bool hastokens(const Query *q, const char *s, const Bool multi);
+static void itemindexadd(Menu *m, uint64_t h, unsigned int item);
+static unsigned int learnpredict(Menu *m, const char *s);
+static double learnscore(const Learned *l, uint32_t now);
+static Bool match(Menu *m, size_t pos[2]);
+static int matchplan(const Query *q, size_t want, size_t *slice, double *est);
+static void *matchworker(void *arg);
+static size_t matchext(Query *q, size_t i, size_t end, size_t n);
+static size_t matchapprox(Query *q, size_t i, size_t end, size_t n);
+static size_t matchstr(Query *q, size_t i, size_t end, size_t n);
+static INLINE size_t strkernel(Query *q, size_t i, size_t end, size_t n, const Bool fold, const Bool multi);
+static size_t matchtok(Query *q, size_t i, size_t end, size_t n);
+static INLINE size_t tokkernel(Query *q, size_t i, size_t end, size_t n, const Bool fold, const Bool multi);
+static size_t matchfuzzy(Query *q, size_t i, size_t end, size_t n);
+static INLINE size_t fuzzykernel(Query *q, size_t i, size_t end, size_t n, const Bool fold, const Bool multi);
+static size_t matchregex(Query *q, size_t i, size_t end, size_t n);
+static void patbuild(Query *q);
+static void planbuild(Query *q);
+static void planorder(Query *q);
+static void queryfree(Query *q);
+static size_t refine(Query *q);
+static Bool regbuild(Query *q, const char *s);
+static Bool relit(char *d, const char *s);
+static size_t scan(Query *q, size_t i, size_t end, size_t n);
+static void siginit(void);
+static uint64_t signature(const char *s);
+static void sortmatches(Menu *m, size_t n, int ntiers);
+static Bool termmatch(const Term *t, const char *s);
+static uint32_t texthandle(Menu *m, size_t i, const char *text);
+static uint64_t texthash(const char *s);
+static void workidle(Menu *m);
+
+static pthread_once_t sigonce = PTHREAD_ONCE_INIT;
+static uint64_t sigbits[256];  /* classes of each byte, the same for all menus */
+
+Menu *
+initmenu(int matcher, int options, int maxerr) {
+	static size_t (*const matchers[])(Query *, size_t, size_t, size_t) = {
+		[MenuSub] = matchstr, [MenuTok] = matchtok, [MenuFuzzy] = matchfuzzy,
+		[MenuRegex] = matchregex, [MenuApprox] = matchapprox
+	};
+	Menu *m;
+
+	pthread_once(&sigonce, siginit);
+	if(!(m = calloc(1, sizeof *m)))
+		die("cannot malloc %u bytes:", sizeof *m);
+	m->matchfn = matchers[(matcher >= MenuSub && matcher <= MenuApprox) ? matcher : MenuSub];
+	m->foldcase = (options & MenuFold) != 0;
+	m->ntiers = 3;
+	if(matcher == MenuApprox) {
+		m->maxerr = MIN(MAX(maxerr, 0), 64 / 3);
+		m->ntiers = 3 * (m->maxerr + 1);
+	}
+	if(options & MenuExtended) {
+		m->fuzzyterms = (m->matchfn == matchfuzzy);
+		m->matchfn = matchext;
+	}
+	m->query.m = m->workq.m = m;
+	m->membudget = SIZE_MAX;
+	m->spillfd = -1;
+	m->predicted = UINT_MAX;
+	m->wakefd[0] = m->wakefd[1] = -1;
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->workcond, NULL);
+	pthread_cond_init(&m->donecond, NULL);
+	return m;
+}
+
+void
+freemenu(Menu *m) {
+	Cached *c;
+	Block *b;
+
+	if(m->wakefd[0] != -1) {
+		/* a scan in progress gives up at the next chunk */
+		pthread_mutex_lock(&m->lock);
+		m->quit = True;
+		m->matchgen++;
+		pthread_cond_signal(&m->workcond);
+		pthread_mutex_unlock(&m->lock);
+		pthread_join(m->worker, NULL);
+		close(m->wakefd[0]);
+		close(m->wakefd[1]);
+	}
+	queryfree(&m->query);
+	queryfree(&m->workq);
+	for(c = m->cache; c < m->cache + CACHE_SIZE; c++) {
+		free(c->text);
+		free(c->v);
+	}
+	for(b = m->blocks; b < m->blocks + m->nblocks; b++)
+		if(b->spilled)
+			munmap(b->p, b->size);
+		else
+			free(b->p);
+	if(m->spillfd != -1)
+		close(m->spillfd);
+	if(m->learn)
+		munmap(m->learn, sizeof *m->learn);
+	free(m->blocks);
+	free(m->textref);
+	free(m->srcs);
+	free(m->segs);
+	free(m->segbase);
+	free(m->sigs);
+	free(m->matches);
+	free(m->matchbuf);
+	free(m->matchtier);
+	free(m->foldref);
+	free(m->itemindex);
+	pthread_mutex_destroy(&m->lock);
+	pthread_cond_destroy(&m->workcond);
+	pthread_cond_destroy(&m->donecond);
+	free(m);
+}
+
+void
+menubudget(Menu *m, size_t bytes) {
+	m->membudget = bytes;
+}
+
+/* map the learn file, making it if it is empty.  Any other file is left as
+ * it is. */
+int
+menulearn(Menu *m, const char *file) {
+	struct stat st;
+	int fd, err = 0;
+
+	if((fd = open(file, O_RDWR | O_CREAT, 0600)) == -1 || fstat(fd, &st) == -1
+	|| (st.st_size == 0 && ftruncate(fd, sizeof *m->learn) == -1))
+		err = errno;
+	else if(st.st_size != 0 && st.st_size != sizeof *m->learn)
+		err = EINVAL;
+	else if((m->learn = mmap(NULL, sizeof *m->learn, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		err = errno;
+	else if(st.st_size == 0) {
+		m->learn->magic = LEARN_MAGIC;
+		m->learn->version = 1;
+	}
+	else if(m->learn->magic != LEARN_MAGIC || m->learn->version != 1) {
+		munmap(m->learn, sizeof *m->learn);
+		err = EINVAL;
+	}
+	if(err)
+		m->learn = NULL;
+	if(fd != -1)
+		close(fd);
+	errno = err;
+	return m->learn != NULL;
+}
+
+void
+menuadd(Menu *m, const char *text, size_t len, int src) {
+	workidle(m);
+	if(m->addsize - m->addlen <= len) {
+		/* the items in the old block stay where they are */
+		m->addsize = MAX(ARENA_BLOCK, len + 1);
+		m->addbuf = blockalloc(m, m->addsize);
+		m->addlen = 0;
+	}
+	memcpy(m->addbuf + m->addlen, text, len);
+	m->addbuf[m->addlen + len] = '\0';
+	additem(m, m->addbuf + m->addlen, len, src);
+	m->addlen += len + 1;
+}
+
+void
+menuaddref(Menu *m, const char *text, size_t len, int src) {
+	workidle(m);
+	additem(m, text, len, src);
+}
+
+/* read one block from fd into the arena of src and split it into items */
+ssize_t
+menuread(Menu *m, int fd, int delim, int src) {
+  Reader *s = &m->readers[MIN(MAX(src, 0), MENU_SOURCES - 1)];
+  char *p, *q, *end;
+  ssize_t n;
+
+  workidle(m);
+  if (s->size - s->len <= BUFSIZ) {
+    /* block is full, carry the unfinished line over into a new one */
+    n = s->len - s->start;
+    p = s->buf;
+    s->size = (s->start == 0 && p) ? 2 * s->size : MAX(ARENA_BLOCK, 2 * n + BUFSIZ);
+    s->buf = blockalloc(m, s->size);
+    if (n > 0)
+      memcpy(s->buf, p + s->start, n);
+    /* a block holding just the start of one long line has no items */
+    if (s->start == 0 && p)
+      blockfree(m, p);
+    s->start = 0;
+    s->len = n;
+  }
+
+  /* one byte stays free to terminate a last line without delimiter */
+  while ((n = read(fd, s->buf + s->len, s->size - s->len - 1)) == -1 && errno == EINTR);
+  if (n == -1 && errno == EAGAIN) /* a source with nothing more for now */
+    return n;
+  if (n <= 0) {
+    if (s->start < s->len) {
+      s->buf[s->len++] = '\0';
+      additem(m, s->buf + s->start, s->len - s->start - 1, src);
+      s->start = s->len;
+    }
+    return n;
+  }
+
+  end = s->buf + s->len + n;
+  for (p = s->buf + s->len; (q = memchr(p, delim, end - p)); p = q + 1) {
+    *q = '\0';
+    additem(m, s->buf + s->start, q - (s->buf + s->start), src);
+    s->start = q + 1 - s->buf;
+  }
+  s->len += n;
+  return n;
+}
+
+/* the item keeps its index, but matches nothing any more */
+void
+menuremove(Menu *m, size_t item) {
+	workidle(m);
+	if(item < m->nitems && (m->sigs[item] & SIG_LIVE)) {
+		m->sigs[item] = 0;
+		m->removed++;
+		m->dead++;
+	}
+}
+
+size_t
+menudead(const Menu *m) {
+	return m->dead;
+}
+
+/* drop the removed items, the rest move down in order and keep their text
+ * where it is, under handles into segments counted afresh */
+void
+menucompact(Menu *m, unsigned int *map) {
+	const uintptr_t *segs = m->segs;
+	const size_t *segbase = m->segbase;
+	const uint32_t *textref = m->textref, *foldref = m->foldref;
+	const char *text, *folded = NULL;
+	Indexed *index = m->itemindex;
+	size_t i, k, n, size = m->itemindexsize, fresh = SIZE_MAX, scanned = SIZE_MAX;
+	unsigned int *to = map;
+
+	/* an unfinished pattern leaves removed items in the result, they are
+	 * dropped below */
+	menuupdate(m);
+	workidle(m);
+	menucollect(m);
+	if(!to && !(to = malloc(m->nitems * sizeof *to)))
+		die("cannot malloc %u bytes:", m->nitems * sizeof *to);
+	m->segs = NULL;
+	m->segbase = NULL;
+	m->nsegs = m->segsize = m->nsegbase = 0;
+	for(i = n = 0; i < m->nitems; i++) {
+		/* where the items not matched yet start now */
+		if(i == m->fresh)
+			fresh = n;
+		if(i == m->donescanned)
+			scanned = n;
+		if(!(m->sigs[i] & SIG_LIVE)) {
+			to[i] = UINT_MAX;
+			continue;
+		}
+		text = ITEMTEXT(False, i);
+		if(m->foldcase)
+			folded = ITEMTEXT(True, i);
+		m->textref[n] = texthandle(m, n, text);
+		if(m->foldcase)
+			m->foldref[n] = texthandle(m, n, folded);
+		m->srcs[n] = m->srcs[i];
+		m->sigs[n] = m->sigs[i];
+		to[i] = n++;
+	}
+	free((void *)segs);
+	free((void *)segbase);
+
+	/* the result keeps its order, less what is gone */
+	for(i = k = 0; i < m->nmatches; i++)
+		if(to[m->matches[i]] != UINT_MAX)
+			m->matches[k++] = to[m->matches[i]];
+	m->nmatches = k;
+	m->settled = MIN(m->settled, k);
+	for(i = k = 0; i < m->ncand; i++)
+		if(to[m->matchbuf[i]] != UINT_MAX) {
+			m->matchtier[k] = m->matchtier[i];
+			m->matchbuf[k++] = to[m->matchbuf[i]];
+		}
+	m->ncand = k;
+	if(m->predicted != UINT_MAX)
+		m->predicted = to[m->predicted];
+	cacheclear(m);
+	m->nitems = n;
+	m->fresh = MIN(fresh, n);
+	m->removed = m->dead = 0;
+	pthread_mutex_lock(&m->lock);
+	m->donen = m->ncand;
+	m->donescanned = MIN(scanned, n);
+	pthread_mutex_unlock(&m->lock);
+	/* refile the items learning looks up */
+	m->itemindex = NULL;
+	m->itemindexsize = 0;
+	for(i = 0; i < size; i++)
+		if(index[i].item != INDEX_EMPTY && to[index[i].item] != UINT_MAX)
+			itemindexadd(m, index[i].hash, to[index[i].item]);
+	free(index);
+	if(to != map)
+		free(to);
+}
+
+/* bring the result up to date with the items added and removed since the
+ * last match */
+void
+menuupdate(Menu *m) {
+	size_t i, n, old = m->fresh, pos[2];
+
+	if(old == m->nitems && !m->removed)
+		return;
+	cacheclear(m);
+	if(!m->candvalid)
+		match(m, pos);
+	else if(compile(&m->query, m->text)) {
+		for(i = n = 0; m->removed && i < m->ncand; i++)
+			if(m->sigs[m->matchbuf[i]] & SIG_LIVE) {
+				m->matchbuf[n] = m->matchbuf[i];
+				m->matchtier[n++] = m->matchtier[i];
+			}
+		m->ncand = m->removed ? n : m->ncand;
+		m->ncand = scan(&m->query, old, m->nitems, m->ncand);
+		sortmatches(m, m->ncand, m->ntiers);
+	}
+	else {
+		/* an unfinished pattern keeps its result, less what is gone */
+		for(i = n = 0; m->removed && i < m->nmatches; i++)
+			if(m->sigs[m->matches[i]] & SIG_LIVE)
+				m->matches[n++] = m->matches[i];
+		m->nmatches = m->removed ? n : m->nmatches;
+	}
+	m->fresh = m->nitems;
+	m->removed = 0;
+}
+
+int
+menubusy(Menu *m) {
+	Bool busy;
+
+	pthread_mutex_lock(&m->lock);
+	busy = m->workbusy;
+	pthread_mutex_unlock(&m->lock);
+	return busy;
+}
+
+size_t
+menuitems(const Menu *m) {
+	return m->nitems;
+}
+
+const char *
+menuitem(const Menu *m, size_t item) {
+	const uintptr_t *segs = m->segs;
+	const size_t *segbase = m->segbase;
+
+	return SEGTEXT(item, m->textref[item]);
+}
+
+const char *
+menulongest(const Menu *m) {
+	return m->maxstr;
+}
+
+int
+menumatch(Menu *m, const char *s, size_t want, size_t pos[2]) {
+	if(m->cached) {
+		/* come back to the same selection if this query is typed again */
+		m->cached->pos[0] = pos[0];
+		m->cached->pos[1] = pos[1];
+	}
+	snprintf(m->text, sizeof m->text, "%s", s);
+	m->want = want;
+	return match(m, pos);
+}
+
+int
+menupending(const Menu *m) {
+	return m->pending;
+}
+
+int
+menufd(const Menu *m) {
+	return m->wakefd[0];
+}
+
+/* take over whatever the worker has found so far for the current query */
+int
+menucollect(Menu *m) {
+	char buf[64];
+	size_t n;
+	Bool final;
+
+	while(m->wakefd[0] != -1 && read(m->wakefd[0], buf, sizeof buf) == sizeof buf);
+	if(!m->pending)
+		return 0;
+	pthread_mutex_lock(&m->lock);
+	if(m->donegen != m->matchgen) {
+		pthread_mutex_unlock(&m->lock);
+		return 0;
+	}
+	n = m->donen;
+	final = (m->donescanned == m->nitems);
+	pthread_mutex_unlock(&m->lock);
+
+	sortmatches(m, m->ncand = n, m->ntiers);
+	m->pending = !final;
+	m->candvalid = final;
+	if(final)
+		cacheput(m, m->text);
+	return 1;
+}
+
+/* block until the worker has finished the current query */
+void
+menuwait(Menu *m) {
+	if(!m->pending)
+		return;
+	pthread_mutex_lock(&m->lock);
+	while(m->donegen != m->matchgen || m->donescanned != m->nitems)
+		pthread_cond_wait(&m->donecond, &m->lock);
+	pthread_mutex_unlock(&m->lock);
+}
+
+const unsigned int *
+menuresults(const Menu *m) {
+	return m->matches;
+}
+
+size_t
+menucount(const Menu *m) {
+	return m->nmatches;
+}
+
+size_t
+menusettled(const Menu *m) {
+	return m->settled;
+}
+
+/* remember that item was picked after typing s, under each prefix of s */
+void
+menupick(Menu *m, const char *s, size_t item) {
+	uint32_t now = time(NULL) / 3600;
+	uint64_t h = 14695981039346656037ULL, ih;
+	Learned *l, *empty, *worst;
+	size_t i, k;
+
+	if(!m->learn || item >= m->nitems)
+		return;
+	ih = texthash(menuitem(m, item)) | 1;
+	for(k = 0; s[k] && k < LEARN_PREFIX; k++) {
+		h = (h ^ (unsigned char)s[k]) * 1099511628211ULL;
+		empty = worst = NULL;
+		for(i = 0; i < LEARN_PROBE; i++) {
+			l = &m->learn->slot[(h + i) & (LEARN_SLOTS - 1)];
+			if(l->prefix == (h | 1) && l->item == ih)
+				break;
+			if(!l->prefix && !empty)
+				empty = l;
+			if(l->prefix && (!worst || learnscore(l, now) < learnscore(worst, now)))
+				worst = l;
+		}
+		/* the file stays the same size, a new pair takes the place
+		 * of the least picked one near it */
+		if(i == LEARN_PROBE) {
+			l = empty ? empty : worst;
+			l->prefix = h | 1;
+			l->item = ih;
+			l->count = 0;
+		}
+		l->count += (l->count < UINT32_MAX);
+		l->last = now;
+	}
+}
+
+void
+menustats(Menu *m, FILE *f) {
+	static const char *plannames[] = { "cache", "refine", "scan", "sliced" };
+	const Plan *p;
+	size_t n;
+	int i;
+
+	pthread_mutex_lock(&m->lock);
+	fprintf(f, "dmenu: %zu items, %lu queries (%lu from cache), "
+	        "%.1f%% rejected by signature, %.2f ns/item\n",
+	        m->nitems, m->stats.queries, m->stats.cachehits,
+	        m->stats.scanned ? 100.0 * m->stats.rejected / m->stats.scanned : 0.0,
+	        m->stats.scanned ? (double)m->stats.ns / m->stats.scanned : 0.0);
+	if(m->stats.spilled)
+		fprintf(f, "dmenu: %llu bytes of items spilled to disk\n", m->stats.spilled);
+	for(i = 0, n = 0; i < 63 && 10 * n < 9 * m->nitems; i++)
+		n += m->corpus.lenhist[i];
+	fprintf(f, "dmenu: items of %.1f bytes, 90%% under %lu; learned %.2f ns/item, "
+	        "%.2f ns/candidate\n", (double)m->corpus.bytes / MAX(m->nitems, 1),
+	        1UL << MAX(i - 1, 0), m->corpus.nsitem, m->corpus.nscand);
+	fprintf(f, "dmenu: plans: %lu cache, %lu refine, %lu scan, %lu sliced\n",
+	        m->stats.plans[PlanCache], m->stats.plans[PlanRefine],
+	        m->stats.plans[PlanScan], m->stats.plans[PlanSliced]);
+	/* the last queries, oldest first */
+	for(n = m->stats.queries > PLAN_LOG ? m->stats.queries - PLAN_LOG : 0; n < m->stats.queries; n++) {
+		p = &m->planlog[n % PLAN_LOG];
+		fprintf(f, "dmenu: %-6s %-24s %9zu items, %8.3f ms planned, %8.3f ms\n",
+		        plannames[p->plan], p->text, p->items, p->est / 1e6, p->took / 1e6);
+	}
+	pthread_mutex_unlock(&m->lock);
+}
+
+/* compile all tokens into one automaton, so that a single pass over an
+ * item tells which of them it contains */
+void
+acbuild(Query *q) {
+	size_t need, head, tail;
+	unsigned short st, r, f, *queue;
+	const unsigned char *p;
+	int c, t;
+
+	for(need = 1, t = 0; t < q->tokc; t++)
+		need += strlen(q->tokv[t]);
+	if(need > q->statesize) {
+		q->statesize = need;
+		if(!(q->delta = realloc(q->delta, need * 256 * sizeof *q->delta))
+		|| !(q->fail = realloc(q->fail, 2 * need * sizeof *q->fail))
+		|| !(q->out = realloc(q->out, need * sizeof *q->out)))
+			die("cannot realloc %u bytes:", need * 256 * sizeof *q->delta);
+	}
+	queue = q->fail + q->statesize;
+
+	/* build the trie, 0 marks a missing edge as none leads back to the root */
+	memset(q->delta, 0, 256 * sizeof *q->delta);
+	q->out[0] = 0;
+	q->nstates = 1;
+	for(t = 0; t < q->tokc; t++) {
+		for(st = 0, p = (unsigned char *)q->tokv[t]; *p; st = q->delta[st * 256 + *p++])
+			if(!q->delta[st * 256 + *p]) {
+				memset(&q->delta[q->nstates * 256], 0, 256 * sizeof *q->delta);
+				q->out[q->nstates] = 0;
+				q->delta[st * 256 + *p] = q->nstates++;
+			}
+		q->out[st] |= (uint64_t)1 << t;
+	}
+	q->all = (q->tokc == 64) ? ~(uint64_t)0 : ((uint64_t)1 << q->tokc) - 1;
+
+	/* breadth first, so failure targets are complete before they are used */
+	for(head = tail = 0, c = 0; c < 256; c++)
+		if((st = q->delta[c])) {
+			q->fail[st] = 0;
+			queue[tail++] = st;
+		}
+	while(head < tail) {
+		r = queue[head++];
+		f = q->fail[r];
+		q->out[r] |= q->out[f];
+		for(c = 0; c < 256; c++)
+			if((st = q->delta[r * 256 + c])) {
+				q->fail[st] = q->delta[f * 256 + c];
+				queue[tail++] = st;
+			}
+			else
+				q->delta[r * 256 + c] = q->delta[f * 256 + c];
+	}
+}
+
+Bool
+acmatch(const Query *q, const char *s) {
+	uint64_t found = 0;
+	unsigned short st = 0;
+
+	for(; *s; s++)
+		if((found |= q->out[st = q->delta[st * 256 + (unsigned char)*s]]) == q->all)
+			return True;
+	return False;
+}
+
+void
+additem(Menu *m, const char *text, size_t len, int src) {
+	uint64_t sig;
+	size_t i = m->nitems;
+	int b;
+
+	if(m->nitems >= m->itemsize) {
+		m->itemsize = MAX(2 * m->itemsize, BUFSIZ / sizeof *m->textref);
+		if(!(m->textref = realloc(m->textref, m->itemsize * sizeof *m->textref))
+		|| !(m->srcs = realloc(m->srcs, m->itemsize))
+		|| !(m->sigs = realloc(m->sigs, m->itemsize * sizeof *m->sigs))
+		|| !(m->matches = realloc(m->matches, (m->itemsize + 1) * sizeof *m->matches))
+		|| !(m->matchbuf = realloc(m->matchbuf, (m->itemsize + 1) * sizeof *m->matchbuf))
+		|| !(m->matchtier = realloc(m->matchtier, m->itemsize + 1)))
+			die("cannot realloc %u bytes:", m->itemsize * sizeof *m->sigs);
+	}
+	src = MIN(MAX(src, 0), MENU_SOURCES - 1);
+	m->nsrcs = MAX(m->nsrcs, src + 1);
+	m->textref[i] = texthandle(m, i, text);
+	m->srcs[i] = src;
+	m->sigs[i] = signature(m->foldcase ? foldadd(m, i, text, len) : text);
+	/* what the planner knows of the items before matching any */
+	m->corpus.bytes += len;
+	for(sig = m->sigs[i] & ~SIG_LIVE; sig; sig &= sig - 1)
+		m->corpus.sigcount[__builtin_ctzll(sig)]++;
+	for(b = 0; len >> b; b++);
+	m->corpus.lenhist[b]++;
+	/* the text is still in cache, index it for learning now */
+	if(m->learn)
+		itemindexadd(m, texthash(text) | 1, i);
+	if(len > m->maxlen) {
+		m->maxlen = len;
+		m->maxstr = text;
+	}
+	m->nitems++;
+}
+
+/* a block for item text: from the heap while item text stays within the
+ * budget, past it from the spill file, whose pages the kernel can write
+ * out and drop again */
+char *
+blockalloc(Menu *m, size_t size) {
+	const char *dir;
+	char path[PATH_MAX], *p;
+	long pagesize;
+	Bool spilled = (m->heapbytes + size > m->membudget);
+	int err;
+
+	if(m->nblocks == m->blocksize) {
+		m->blocksize = MAX(2 * m->blocksize, 64);
+		if(!(m->blocks = realloc(m->blocks, m->blocksize * sizeof *m->blocks)))
+			die("cannot realloc %u bytes:", m->blocksize * sizeof *m->blocks);
+	}
+	if(!spilled) {
+		if(!(p = malloc(size)))
+			die("cannot malloc %u bytes:", size);
+		m->heapbytes += size;
+	}
+	else {
+		if(m->spillfd == -1) {
+			if(!(dir = getenv("TMPDIR")))
+				dir = "/var/tmp";
+			snprintf(path, sizeof path, "%s/dmenuXXXXXX", dir);
+			if((m->spillfd = mkstemp(path)) == -1)
+				die("cannot create spill file in %s:", dir);
+			unlink(path);
+			fcntl(m->spillfd, F_SETFD, FD_CLOEXEC);
+		}
+		pagesize = sysconf(_SC_PAGESIZE);
+		size = (size + pagesize - 1) / pagesize * pagesize;
+		/* allocate the disk space now, a full disk would fault on access */
+		if((err = posix_fallocate(m->spillfd, m->spilllen, size))) {
+			errno = err;
+			die("cannot spill %u bytes:", size);
+		}
+		if((p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->spillfd, m->spilllen)) == MAP_FAILED)
+			die("cannot map %u bytes:", size);
+		/* items are matched in order, read ahead and drop what is behind */
+		madvise(p, size, MADV_SEQUENTIAL);
+		m->spilllen += size;
+		pthread_mutex_lock(&m->lock);
+		m->stats.spilled += size;
+		pthread_mutex_unlock(&m->lock);
+	}
+	m->blocks[m->nblocks].p = p;
+	m->blocks[m->nblocks].size = size;
+	m->blocks[m->nblocks++].spilled = spilled;
+	return p;
+}
+
+void
+blockfree(Menu *m, char *p) {
+	Block *b;
+
+	for(b = m->blocks + m->nblocks; b-- > m->blocks && b->p != p; );
+	if(!b->spilled) {
+		free(p);
+		m->heapbytes -= b->size;
+	}
+	else /* its place in the spill file is not reused */
+		munmap(p, b->size);
+	*b = m->blocks[--m->nblocks];
+}
+
+Cached *
+cacheget(Menu *m, const char *s) {
+	Cached *c;
+
+	for(c = m->cache; c < m->cache + CACHE_SIZE; c++)
+		if(c->used && !strcmp(c->text, s)) {
+			c->used = ++m->cacheclock;
+			return c;
+		}
+	return NULL;
+}
+
+/* remember the current, complete result for query s; slots keep their
+ * buffers when they are freed, so once they have grown this allocates
+ * nothing */
+void
+cacheput(Menu *m, const char *s) {
+	Cached *c, *lru, *slot, *cache = m->cache;
+	size_t len = strlen(s) + 1, need;
+	Bool spare;
+
+	m->cached = NULL;
+	/* room in powers of two, so that slots soon fit any result */
+	for(need = 64; need < m->nmatches; need *= 2);
+	if(need * sizeof *m->matches > CACHE_BUDGET)
+		return;
+	/* take the free slot with the most room; while growing it would break
+	 * the budget, give up the room of other free slots, then evict the
+	 * least recently used result */
+	for(;;) {
+		for(lru = slot = NULL, c = cache; c < cache + CACHE_SIZE; c++)
+			if(c->used) {
+				if(!lru || c->used < lru->used)
+					lru = c;
+			}
+			else if(!slot || c->vsize > slot->vsize)
+				slot = c;
+		if(slot && (slot->vsize >= need
+		|| m->cachebytes + (need - slot->vsize) * sizeof *m->matches <= CACHE_BUDGET))
+			break;
+		for(spare = False, c = cache; c < cache + CACHE_SIZE; c++)
+			if(!c->used && c != slot && c->vsize) {
+				m->cachebytes -= c->vsize * sizeof *m->matches;
+				free(c->v);
+				c->v = NULL;
+				c->vsize = 0;
+				spare = True;
+			}
+		if(!spare)
+			lru->used = 0;
+	}
+	if(slot->vsize < need) {
+		if(!(slot->v = realloc(slot->v, need * sizeof *m->matches)))
+			die("cannot realloc %u bytes:", need * sizeof *m->matches);
+		m->cachebytes += (need - slot->vsize) * sizeof *m->matches;
+		slot->vsize = need;
+	}
+	if(slot->textsize < len) {
+		slot->textsize = MAX(len, 64);
+		if(!(slot->text = realloc(slot->text, slot->textsize)))
+			die("cannot realloc %u bytes:", slot->textsize);
+	}
+	memcpy(slot->text, s, len);
+	memcpy(slot->v, m->matches, m->nmatches * sizeof *m->matches);
+	slot->n = m->nmatches;
+	/* the caller's positions are stored when the next query comes */
+	slot->pos[0] = slot->pos[1] = 0;
+	slot->used = ++m->cacheclock;
+	m->cached = slot;
+}
+
+/* forget all results, the items they came from changed */
+void
+cacheclear(Menu *m) {
+	Cached *c;
+
+	for(c = m->cache; c < m->cache + CACHE_SIZE; c++)
+		c->used = 0;
+	m->cached = NULL;
+}
+
+/* expected cost of ruling an item out with c, tests that are cheap and
+ * rarely passed go first */
+double
+clauserank(const Clause *c) {
+	double p = (c->hits + 4 * c->prior) / (c->tries + 4);
+
+	return c->cost / (1.0 - p + 1e-3);
+}
+
+Bool
+compile(Query *q, const char *s) {
+	Menu *m = q->m;
+	char *t, *save;
+	int i;
+
+	if(m->matchfn == matchregex)
+		return regbuild(q, s);
+	if(m->foldcase)
+		fold(q->text, s);
+	else
+		strcpy(q->text, s);
+	strcpy(q->buf, q->text);
+	/* separate input text into tokens to be matched individually */
+	for(q->tokc = 0, t = strtok_r(q->buf, " ", &save); t; t = strtok_r(NULL, " ", &save))
+		q->tokv[q->tokc++] = t;
+	q->len = q->tokc ? strlen(q->tokv[0]) : 0;
+	for(q->sig = SIG_LIVE, i = 0; i < q->tokc; i++)
+		q->sig |= signature(q->tokv[i]);
+	if(m->matchfn == matchapprox)
+		patbuild(q);
+	q->nstates = 0;
+	if(m->matchfn == matchext)
+		planbuild(q);
+	/* one strstr() beats the automaton for a single token */
+	else if(q->tokc > 1 && q->tokc <= 64)
+		acbuild(q);
+	return True;
+}
+
+void
+die(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	if(fmt[0] != '\0' && fmt[strlen(fmt)-1] == ':') {
+		fputc(' ', stderr);
+		perror(NULL);
+	}
+	exit(EXIT_FAILURE);
+}
+
+/* smallest edit distance between p and any substring of s, using
+ * Myers' bit-parallel algorithm */
+int
+editdist(const Pattern *p, const char *s) {
+	uint64_t pv = ~(uint64_t)0, mv = 0, eq, xv, xh, ph, mh;
+	uint64_t high = (uint64_t)1 << (p->len - 1);
+	int score = p->len, best = p->len;
+
+	for(; *s && best > 0; s++) {
+		eq = p->peq[(unsigned char)*s];
+		xv = eq | mv;
+		xh = (((eq & pv) + pv) ^ pv) | eq;
+		ph = mv | ~(xh | pv);
+		mh = pv & xh;
+		if(ph & high)
+			score++;
+		else if(mh & high)
+			score--;
+		/* nothing shifted in, a match may start anywhere in s */
+		ph <<= 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+		best = MIN(best, score);
+	}
+	return best;
+}
+
+/* write the case folded form of the UTF-8 string s to d, return its end */
+char *
+fold(char *d, const char *s) {
+	const unsigned char *p = (const unsigned char *)s;
+	wint_t c;
+	int i, n;
+
+	while(*p) {
+		if(*p < 0x80) {
+			*d++ = (*p >= 'A' && *p <= 'Z') ? *p + 'a' - 'A' : *p;
+			p++;
+			continue;
+		}
+		/* decode one rune, invalid sequences are copied through */
+		n = (*p >= 0xf0) ? 3 : (*p >= 0xe0) ? 2 : (*p >= 0xc0) ? 1 : 0;
+		for(c = *p & (0x3f >> n), i = 1; i <= n && (p[i] & 0xc0) == 0x80; i++)
+			c = (c << 6) | (p[i] & 0x3f);
+		if(n == 0 || i <= n || *p >= 0xf8) {
+			*d++ = *p++;
+			continue;
+		}
+		p += i;
+		/* approximate simple case folding, e.g. both sigma forms fold alike */
+		c = towlower(towupper(c));
+		if(c < 0x80)
+			*d++ = c;
+		else if(c < 0x800) {
+			*d++ = 0xc0 | (c >> 6);
+			*d++ = 0x80 | (c & 0x3f);
+		}
+		else if(c < 0x10000) {
+			*d++ = 0xe0 | (c >> 12);
+			*d++ = 0x80 | ((c >> 6) & 0x3f);
+			*d++ = 0x80 | (c & 0x3f);
+		}
+		else {
+			*d++ = 0xf0 | (c >> 18);
+			*d++ = 0x80 | ((c >> 12) & 0x3f);
+			*d++ = 0x80 | ((c >> 6) & 0x3f);
+			*d++ = 0x80 | (c & 0x3f);
+		}
+	}
+	*d = '\0';
+	return d;
+}
+
+/* append the folded form of item i to the shadow arena and return it */
+const char *
+foldadd(Menu *m, size_t i, const char *s, size_t len) {
+	char *d;
+
+
+	/* folding grows a rune by at most half its length */
+	if(m->foldlen + 2 * len + 1 > m->foldsize) {
+		m->foldsize = MAX(ARENA_BLOCK, 2 * len + 1);
+		m->foldbuf = blockalloc(m, m->foldsize);
+		m->foldlen = 0;
+	}
+	if(i >= m->foldn) {
+		m->foldn = MAX(2 * m->foldn, i + 1);
+		if(!(m->foldref = realloc(m->foldref, m->foldn * sizeof *m->foldref)))
+			die("cannot realloc %u bytes:", m->foldn * sizeof *m->foldref);
+	}
+	d = m->foldbuf + m->foldlen;
+	m->foldref[i] = texthandle(m, i, d);
+	m->foldlen = fold(d, s) - m->foldbuf + 1;
+	return d;
+}
+
+/* check that s contains every token of the query, multi if it has an
+ * automaton */
+Bool
+hastokens(const Query *q, const char *s, const Bool multi) {
+	int t;
+
+	if(multi)
+		return acmatch(q, s);
+	for(t = 0; t < q->tokc; t++)
+		if(!strstr(s, q->tokv[t]))
+			return False;
+	return True;
+}
+
+/* file item under the hash h of its text, for learnpredict() to find it by */
+void
+itemindexadd(Menu *m, uint64_t h, unsigned int item) {
+	Indexed *old = m->itemindex, *index;
+	size_t i, k, size, oldsize = m->itemindexsize;
+
+	if(2 * (m->nitems + 1) > m->itemindexsize) {
+		for(size = MAX(oldsize, 1024); 2 * (m->nitems + 1) > size; size *= 2);
+		if(!(index = malloc(size * sizeof *index)))
+			die("cannot malloc %u bytes:", size * sizeof *index);
+		for(i = 0; i < size; i++)
+			index[i].item = INDEX_EMPTY;
+		for(k = 0; k < oldsize; k++)
+			if(old[k].item != INDEX_EMPTY) {
+				for(i = old[k].hash & (size - 1); index[i].item != INDEX_EMPTY; i = (i + 1) & (size - 1));
+				index[i] = old[k];
+			}
+		free(old);
+		m->itemindex = index;
+		m->itemindexsize = size;
+	}
+	index = m->itemindex;
+	size = m->itemindexsize;
+	for(i = h & (size - 1); index[i].item != INDEX_EMPTY; i = (i + 1) & (size - 1));
+	index[i].hash = h;
+	index[i].item = item;
+}
+
+/* the item most often picked after typing s, or UINT_MAX */
+unsigned int
+learnpredict(Menu *m, const char *s) {
+	uint32_t now = time(NULL) / 3600;
+	uint64_t h = texthash(s), ih = 0;
+	const Learned *l;
+	double best = 0;
+	size_t i, j;
+
+	if(!m->learn || !m->itemindex || !*s || strlen(s) > LEARN_PREFIX)
+		return UINT_MAX;
+	for(i = 0; i < LEARN_PROBE; i++) {
+		l = &m->learn->slot[(h + i) & (LEARN_SLOTS - 1)];
+		if(l->prefix == (h | 1) && l->count >= LEARN_MIN && learnscore(l, now) > best) {
+			best = learnscore(l, now);
+			ih = l->item;
+		}
+	}
+	for(j = ih & (m->itemindexsize - 1); ih && m->itemindex[j].item != INDEX_EMPTY; j = (j + 1) & (m->itemindexsize - 1))
+		if(m->itemindex[j].hash == ih)
+			return m->itemindex[j].item;
+	return UINT_MAX;
+}
+
+/* picks count less as they age */
+double
+learnscore(const Learned *l, uint32_t now) {
+	return l->count / (1.0 + (double)(now - MIN(l->last, now)) / LEARN_AGE);
+}
+
+/* start matching m->text; large lists are scanned by the worker */
+Bool
+match(Menu *m, size_t pos[2]) {
+	struct timespec t0, t1;
+	Cached *c;
+	Plan *p;
+	size_t i, end, n, n0, slice = FIRST_SLICE, top = 0, old = m->ncand;
+	double est = 0, ns;
+	int plan, fd;
+
+	/* an incomplete pattern keeps the last valid result, a complete one is
+	 * compiled once, here */
+	if(m->matchfn == matchregex && !compile(&m->query, m->text))
+		return False;
+	/* items added or removed behind menuupdate()'s back void what is known */
+	if(m->fresh != m->nitems || m->removed) {
+		cacheclear(m);
+		m->candvalid = False;
+		m->fresh = m->nitems;
+		m->removed = 0;
+	}
+	pthread_mutex_lock(&m->lock);
+	m->matchgen++;
+	m->stats.queries++;
+	if((c = cacheget(m, m->text))) {
+		m->stats.cachehits++;
+		m->stats.plans[PlanCache]++;
+		pthread_mutex_unlock(&m->lock);
+		p = &m->planlog[(m->stats.queries - 1) % PLAN_LOG];
+		snprintf(p->text, sizeof p->text, "%.*s", (int)sizeof p->text - 1, m->text);
+		p->plan = PlanCache;
+		p->items = 0;
+		p->est = p->took = 0;
+		memcpy(m->matches, c->v, c->n * sizeof *m->matches);
+		m->nmatches = m->settled = c->n;  /* a cached result is complete */
+		pos[0] = c->pos[0];
+		pos[1] = c->pos[1];
+		m->cached = c;
+		m->pending = False;
+		m->candvalid = False;
+		return True;
+	}
+	m->cached = NULL;
+	/* the worker must be done with matchbuf before it is refilled */
+	while(m->workbusy)
+		pthread_cond_wait(&m->donecond, &m->lock);
+	pthread_mutex_unlock(&m->lock);
+	if(m->matchfn != matchregex)
+		compile(&m->query, m->text);
+	m->predicted = learnpredict(m, m->text);
+
+	plan = matchplan(&m->query, m->want, &slice, &est);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(plan == PlanRefine) {
+		n = refine(&m->query);
+		end = m->nitems;
+	}
+	/* scan until the first pages are settled, a large list in slices so
+	 * that they are shown before the rest is even looked at */
+	else for(end = n = 0; end < m->nitems; slice *= 2) {
+		i = end;
+		end = plan == PlanScan ? m->nitems : MIN(end + slice, MATCH_CHUNK);
+		for(n = scan(&m->query, i, end, n0 = n); n0 < n; n0++)
+			top += (SORTKEY(m, n0) == 0);
+		if(top >= m->want || end >= MATCH_CHUNK)
+			break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	p = &m->planlog[(m->stats.queries - 1) % PLAN_LOG];
+	snprintf(p->text, sizeof p->text, "%.*s", (int)sizeof p->text - 1, m->text);
+	p->plan = plan;
+	p->items = plan == PlanRefine ? old : end;
+	p->est = est;
+	p->took = ns;
+	pthread_mutex_lock(&m->lock);
+	m->stats.plans[plan]++;
+	if(plan == PlanRefine)  /* scan() did not time it */
+		m->stats.ns += ns;
+	/* few candidates say little about the cost of the next refinement */
+	if(plan == PlanRefine && old >= 256)
+		m->corpus.nscand = m->corpus.nscand ? (3 * m->corpus.nscand + ns / old) / 4 : ns / old;
+	pthread_mutex_unlock(&m->lock);
+	strcpy(m->candtext, m->text);
+	sortmatches(m, m->ncand = n, m->ntiers);
+	/* a pick found later would move the page the user is looking at */
+	if(m->nmatches == 0 || m->matches[0] != m->predicted)
+		m->predicted = UINT_MAX;
+	pos[0] = pos[1] = 0;
+	m->pending = (end < m->nitems);
+	m->candvalid = !m->pending;
+	if(!m->pending) {
+		cacheput(m, m->text);
+		return True;
+	}
+
+	/* the rest is counted in the background */
+	pthread_mutex_lock(&m->lock);
+	strcpy(m->worktext, m->text);
+	m->workstart = end;
+	m->workn = n;
+	m->workgen = m->matchgen;
+	m->workbusy = True;
+	if(m->wakefd[0] == -1) {
+		if(pipe(m->wakefd) == -1)
+			die("cannot create pipe:");
+		/* nobody may be reading, a full pipe says enough */
+		for(fd = 0; fd < 2; fd++) {
+			fcntl(m->wakefd[fd], F_SETFL, O_NONBLOCK);
+			fcntl(m->wakefd[fd], F_SETFD, FD_CLOEXEC);
+		}
+		if(pthread_create(&m->worker, NULL, matchworker, m))
+			die("cannot create match thread\n");
+	}
+	pthread_cond_signal(&m->workcond);
+	pthread_mutex_unlock(&m->lock);
+	return True;
+}
+
+/* choose how to match the compiled query q: by narrowing the candidates of
+ * the query it extends, by scanning all items at once, or in slices of
+ * which the first should settle want matches.  Until scans have been
+ * timed their cost is guessed from the length of the items. */
+int
+matchplan(const Query *q, size_t want, size_t *slice, double *est) {
+	Menu *m = q->m;
+	double nsitem, nscand, frac = 1.0;
+	uint64_t sig;
+
+	pthread_mutex_lock(&m->lock);
+	nsitem = m->corpus.nsitem;
+	nscand = m->corpus.nscand;
+	pthread_mutex_unlock(&m->lock);
+	if(nsitem == 0)
+		nsitem = 1 + m->corpus.bytes / (8.0 * MAX(m->nitems, 1));
+	/* candidates are spread over the items, each one a cache miss */
+	if(nscand == 0)
+		nscand = 2 * nsitem;
+
+	/* a longer query matches a subset, unless it can widen the match */
+	if(m->candvalid && !strncmp(m->text, m->candtext, strlen(m->candtext))
+	&& (m->matchfn == matchstr || m->matchfn == matchtok || m->matchfn == matchfuzzy)
+	&& (m->ncand <= MATCH_CHUNK || m->ncand * nscand <= PLAN_BUDGET)) {
+		*est = m->ncand * nscand;
+		return PlanRefine;
+	}
+	*est = m->nitems * nsitem;
+	if(m->nitems <= MATCH_CHUNK || *est <= PLAN_BUDGET)
+		return PlanScan;
+	/* the rarest character class bounds how many items match, rare
+	 * matches take larger slices to fill the first page */
+	for(sig = q->sig & ~SIG_LIVE; sig; sig &= sig - 1)
+		frac = MIN(frac, (double)m->corpus.sigcount[__builtin_ctzll(sig)] / m->nitems);
+	*slice = MIN(MAX(FIRST_SLICE, 2 * want / MAX(frac, 1e-6)), MATCH_CHUNK);
+	return PlanSliced;
+}
+
+void *
+matchworker(void *arg) {
+	Menu *m = arg;
+	Query *q = &m->workq;
+	unsigned long gen = 0;
+	size_t i, end, n, total;
+
+	pthread_mutex_lock(&m->lock);
+	for(;;) {
+		while(gen == m->workgen && !m->quit)
+			pthread_cond_wait(&m->workcond, &m->lock);
+		if(m->quit)
+			break;
+		gen = m->workgen;
+		compile(q, m->worktext);
+		i = m->workstart;
+		n = m->workn;
+		/* the items cannot change while we are busy, nor be read once we
+		 * are not: the last chunk is published and idleness declared
+		 * under one hold of the lock */
+		total = m->nitems;
+		while(i < total) {
+			pthread_mutex_unlock(&m->lock);
+			end = MIN(i + MATCH_CHUNK, total);
+			n = scan(q, i, end, n);
+			pthread_mutex_lock(&m->lock);
+			if(gen != m->matchgen) /* a newer query supersedes this one */
+				break;
+			m->donegen = gen;
+			m->donen = n;
+			m->donescanned = i = end;
+			if(end == total)
+				break;
+			pthread_cond_signal(&m->donecond);
+			pthread_mutex_unlock(&m->lock);
+			while(write(m->wakefd[1], "", 1) == -1 && errno == EINTR);
+			pthread_mutex_lock(&m->lock);
+		}
+		/* idle unless handed the next query meanwhile; tell match() it
+		 * may refill matchbuf and the caller that it may add items */
+		if(gen == m->workgen)
+			m->workbusy = False;
+		pthread_cond_signal(&m->donecond);
+		pthread_mutex_unlock(&m->lock);
+		while(write(m->wakefd[1], "", 1) == -1 && errno == EINTR);
+		pthread_mutex_lock(&m->lock);
+	}
+	pthread_mutex_unlock(&m->lock);
+	return NULL;
+}
+
+size_t
+matchext(Query *q, size_t i, size_t end, size_t n) {
+	const Menu *m = q->m;
+	const uintptr_t *segs = m->segs;
+	const size_t *segbase = m->segbase;
+	const uint32_t *textref = m->textref, *foldref = m->foldref;
+	const uint64_t *sigs = m->sigs;
+	unsigned int *matchbuf = m->matchbuf;
+	unsigned char *matchtier = m->matchtier;
+	const Bool foldcase = m->foldcase;
+	Clause *c, *ce = q->clausev + q->clausec;
+	const Term *r = q->rank >= 0 ? &q->termv[q->rank] : NULL;
+	const char *s;
+	int t;
+
+	planorder(q);
+	for(; i < end; i++) {
+		if(q->sig & ~sigs[i]) {
+			q->rejected++;
+			continue;
+		}
+		s = MATCHTEXT(i);
+		for(c = q->clausev; c < ce; c++) {
+			for(t = c->first; t < c->first + c->n && !termmatch(&q->termv[t], s); t++);
+			c->tries++;
+			if(t == c->first + c->n)
+				break;
+			c->hits++;
+		}
+		if(c != ce)
+			continue;
+		/* rank by the first term as typed, like matchstr() */
+		if(!r || !strcmp(r->s, s))
+			matchtier[n] = 0;
+		else if(!strncmp(r->s, s, r->len))
+			matchtier[n] = 1;
+		else
+			matchtier[n] = 2;
+		matchbuf[n++] = i;
+	}
+	return n;
+}
+
+size_t
+matchapprox(Query *q, size_t i, size_t end, size_t n) {
+	const Menu *m = q->m;
+	const uintptr_t *segs = m->segs;
+	const size_t *segbase = m->segbase;
+	const uint32_t *textref = m->textref, *foldref = m->foldref;
+	const uint64_t *sigs = m->sigs;
+	unsigned int *matchbuf = m->matchbuf;
+	unsigned char *matchtier = m->matchtier;
+	const Bool foldcase = m->foldcase;
+	const char *s;
+	uint64_t miss;
+	int t, d, e, c;
+
+	for(; i < end; i++) {
+		if(!(sigs[i] & SIG_LIVE))
+			continue;
+		s = MATCHTEXT(i);
+		for(d = t = 0; t < q->tokc; t++) {
+			/* every missing character class costs at least one edit */
+			for(miss = q->pat[t].sig & ~sigs[i], c = 0; miss && c <= q->pat[t].maxerr; miss &= miss - 1)
+				c++;
+			if(c > q->pat[t].maxerr) {
+				q->rejected++;
+				break;
+			}
+			if(q->pat[t].len > 64) /* too long for one word, match it exactly */
+				e = strstr(s, q->tokv[t]) ? 0 : q->pat[t].maxerr + 1;
+			else
+				e = editdist(&q->pat[t], s);
+			if(e > q->pat[t].maxerr)
+				break;
+			d = MAX(d, e);
+		}
+		if(t != q->tokc)
+			continue;
+		/* fewest edits first, then exact matches, prefixes and substrings */
+		if(!q->tokc || !strncmp(q->tokv[0], s, q->len+1))
+			matchtier[n] = 3 * d;
+		else if(!strncmp(q->tokv[0], s, q->len))
+			matchtier[n] = 3 * d + 1;
+		else
+			matchtier[n] = 3 * d + 2;
+		matchbuf[n++] = i;
+	}
+	return n;
+}
+
+size_t
+matchstr(Query *q, size_t i, size_t end, size_t n) {
+	return KERNEL(strkernel, q, i, end, n);
+}
+
+/* the kernels keep the query and the arrays of the menu in locals, stores
+ * to matchtier could alias anything behind q */
+size_t
+strkernel(Query *q, size_t i, size_t end, size_t n, const Bool fold, const Bool multi) {
+	const uintptr_t *segs = q->m->segs;
+	const size_t *segbase = q->m->segbase;
+	const uint32_t *textref = q->m->textref, *foldref = q->m->foldref;
+	const uint64_t *sigs = q->m->sigs;
+	unsigned int *matchbuf = q->m->matchbuf;
+	unsigned char *matchtier = q->m->matchtier;
+	const uint64_t sig = q->sig;
+	const char *s, *tok = q->tokv[0];
+	const size_t len = q->len;
+	const Bool any = !q->tokc;
+	size_t rejected = 0;
+
+	for(; i < end; i++) {
+		if(sig & ~sigs[i]) {
+			rejected++;
+			continue;
+		}
+		s = ITEMTEXT(fold, i);
+		if(!hastokens(q, s, multi))
+			continue;
+		/* exact matches go first, then prefixes, then substrings */
+		if(any || !strncmp(tok, s, len+1))
+			matchtier[n] = 0;
+		else if(!strncmp(tok, s, len))
+			matchtier[n] = 1;
+		else
+			matchtier[n] = 2;
+		matchbuf[n++] = i;
+	}
+	q->rejected += rejected;
+	return n;
+}
+
+size_t
+matchtok(Query *q, size_t i, size_t end, size_t n) {
+	return KERNEL(tokkernel, q, i, end, n);
+}
+
+size_t
+tokkernel(Query *q, size_t i, size_t end, size_t n, const Bool fold, const Bool multi) {
+	const uintptr_t *segs = q->m->segs;
+	const size_t *segbase = q->m->segbase;
+	const uint32_t *textref = q->m->textref, *foldref = q->m->foldref;
+	const uint64_t *sigs = q->m->sigs;
+	unsigned int *matchbuf = q->m->matchbuf;
+	unsigned char *matchtier = q->m->matchtier;
+	const uint64_t sig = q->sig;
+	size_t rejected = 0;
+
+	for(; i < end; i++) {
+		if(sig & ~sigs[i])
+			rejected++;
+		else if(hastokens(q, ITEMTEXT(fold, i), multi)) {
+			matchtier[n] = 0;
+			matchbuf[n++] = i;
+		}
+	}
+	q->rejected += rejected;
+	return n;
+}
+
+size_t
+matchfuzzy(Query *q, size_t i, size_t end, size_t n) {
+	return KERNEL(fuzzykernel, q, i, end, n);
+}
+
+size_t
+fuzzykernel(Query *q, size_t i, size_t end, size_t n, const Bool fold, const Bool multi) {
+	const uintptr_t *segs = q->m->segs;
+	const size_t *segbase = q->m->segbase;
+	const uint32_t *textref = q->m->textref, *foldref = q->m->foldref;
+	const uint64_t *sigs = q->m->sigs;
+	unsigned int *matchbuf = q->m->matchbuf;
+	unsigned char *matchtier = q->m->matchtier;
+	const uint64_t sig = q->sig;
+	const char *t, *pos;
+	size_t rejected = 0;
+
+	for(; i < end; i++) {
+		if(sig & ~sigs[i]) {
+			rejected++;
+			continue;
+		}
+		for(t = q->text, pos = ITEMTEXT(fold, i); *t && (pos = strchr(pos, *t)); t++, pos++);
+		if(!*t) {
+			matchtier[n] = 0;
+			matchbuf[n++] = i;
+		}
+	}
+	q->rejected += rejected;
+	return n;
+}
+
+size_t
+matchregex(Query *q, size_t i, size_t end, size_t n) {
+	const Menu *m = q->m;
+	const uintptr_t *segs = m->segs;
+	const size_t *segbase = m->segbase;
+	const uint32_t *textref = m->textref, *foldref = m->foldref;
+	const uint64_t *sigs = m->sigs;
+	unsigned int *matchbuf = m->matchbuf;
+	unsigned char *matchtier = m->matchtier;
+	const Bool foldcase = m->foldcase;
+	const char *s;
+
+	for(; i < end; i++) {
+		if(q->sig & ~sigs[i]) {
+			q->rejected++;
+			continue;
+		}
+		s = MATCHTEXT(i);
+		/* the required literal is far cheaper to look for than the automaton */
+		if(*q->buf && !strstr(s, q->buf))
+			continue;
+		if(q->hasre && regexec(&q->re, s, 0, NULL, 0))
+			continue;
+		matchtier[n] = 0;
+		matchbuf[n++] = i;
+	}
+	return n;
+}
+
+/* prepare the tokens for approximate matching */
+void
+patbuild(Query *q) {
+	Pattern *p;
+	size_t k;
+	int t;
+
+	if((size_t)q->tokc > q->patsize) {
+		q->patsize = q->tokc;
+		if(!(q->pat = realloc(q->pat, q->patsize * sizeof *q->pat)))
+			die("cannot realloc %u bytes:", q->patsize * sizeof *q->pat);
+	}
+	for(t = 0; t < q->tokc; t++) {
+		p = &q->pat[t];
+		p->len = strlen(q->tokv[t]);
+		p->sig = signature(q->tokv[t]);
+		/* short tokens would match nearly anything, allow one edit per 3 bytes */
+		p->maxerr = MIN(q->m->maxerr, (int)p->len / 3);
+		memset(p->peq, 0, sizeof p->peq);
+		for(k = 0; k < p->len && k < 64; k++)
+			p->peq[(unsigned char)q->tokv[t][k]] |= (uint64_t)1 << k;
+	}
+}
+
+/* compile the tokens of an extended query into clauses of alternative
+ * terms, all of which must pass */
+void
+planbuild(Query *q) {
+	static const int cost[] = { [TermSub] = 4, [TermPrefix] = 1, [TermSuffix] = 3,
+	                            [TermWhole] = 1, [TermFuzzy] = 6 };
+	Clause *c;
+	Term *term;
+	uint64_t sig;
+	double p, miss;
+	char *s;
+	size_t len, need;
+	int t, k;
+	Bool alt = False;
+
+	/* remember how selective the previous clauses were, halving old
+	 * counts now and then so recent items weigh more */
+	for(c = q->clausev; c < q->clausev + q->clausec; c++) {
+		k = c->key % PLAN_HISTORY;
+		q->seen[k].key = c->key;
+		q->seen[k].tries = c->tries >> (c->tries > 1 << 20);
+		q->seen[k].hits = c->hits >> (c->tries > 1 << 20);
+	}
+	if((need = q->tokc + 1) > q->termsize) {
+		q->termsize = q->clausesize = need;
+		if(!(q->termv = realloc(q->termv, need * sizeof *q->termv))
+		|| !(q->clausev = realloc(q->clausev, need * sizeof *q->clausev)))
+			die("cannot realloc %u bytes:", need * sizeof *q->clausev);
+	}
+	q->termc = q->clausec = 0;
+	q->rank = -1;
+	for(t = 0; t < q->tokc; t++) {
+		s = q->tokv[t];
+		if(!strcmp(s, "|")) {
+			alt = (q->clausec > 0);
+			continue;
+		}
+		term = &q->termv[q->termc];
+		term->neg = (*s == '!');
+		s += term->neg;
+		if(*s == '\'') { /* quoted, taken literally */
+			term->op = TermSub;
+			s++;
+		}
+		else {
+			term->op = q->m->fuzzyterms ? TermFuzzy : TermSub;
+			if(*s == '^') {
+				term->op = TermPrefix;
+				s++;
+			}
+			if((len = strlen(s)) > 0 && s[len-1] == '$') {
+				s[len-1] = '\0';
+				term->op = (term->op == TermPrefix) ? TermWhole : TermSuffix;
+			}
+		}
+		/* a lone operator being typed matches everything */
+		if(!*s)
+			continue;
+		term->s = s;
+		term->len = strlen(s);
+		if(t == 0 && !term->neg && term->op == TermSub)
+			q->rank = q->termc;
+		if(alt)
+			q->clausev[q->clausec-1].n++;
+		else {
+			c = &q->clausev[q->clausec++];
+			c->first = q->termc;
+			c->n = 1;
+		}
+		q->termc++;
+		alt = False;
+	}
+	q->sig = SIG_LIVE;
+	for(c = q->clausev; c < q->clausev + q->clausec; c++) {
+		c->cost = 0;
+		c->key = 5381;
+		sig = ~(uint64_t)0;
+		for(miss = 1.0, t = c->first; t < c->first + c->n; t++) {
+			term = &q->termv[t];
+			c->cost += cost[term->op];
+			c->key = c->key * 33 + term->op * 2 + term->neg;
+			for(k = 0; term->s[k]; k++)
+				c->key = c->key * 33 + (unsigned char)term->s[k];
+			/* longer and anchored terms are rarer */
+			p = MIN(1.0, (term->op == TermFuzzy ? 4.0 : 2.0) / (term->len + 2));
+			if(term->op == TermPrefix || term->op == TermSuffix)
+				p /= 4;
+			else if(term->op == TermWhole)
+				p /= 16;
+			miss *= term->neg ? p : 1.0 - p;
+			sig &= term->neg ? 0 : signature(term->s);
+		}
+		c->prior = 1.0 - miss;
+		q->sig |= sig;
+		k = c->key % PLAN_HISTORY;
+		if(q->seen[k].key == c->key) {
+			c->tries = q->seen[k].tries;
+			c->hits = q->seen[k].hits;
+		}
+		else
+			c->tries = c->hits = 0;
+	}
+}
+
+/* sort the clauses by what they have cost so far */
+void
+planorder(Query *q) {
+	Clause c;
+	int i, j;
+
+	for(i = 1; i < q->clausec; i++) {
+		c = q->clausev[i];
+		for(j = i; j > 0 && clauserank(&q->clausev[j-1]) > clauserank(&c); j--)
+			q->clausev[j] = q->clausev[j-1];
+		q->clausev[j] = c;
+	}
+}
+
+void
+queryfree(Query *q) {
+	free(q->delta);
+	free(q->fail);
+	free(q->out);
+	free(q->pat);
+	free(q->termv);
+	free(q->clausev);
+	if(q->hasre)
+		regfree(&q->re);
+}
+
+/* match q against the candidates of the query it extends, in runs of
+ * adjacent items, and return how many are left.  They are narrowed in
+ * place, none is written past the run it came from. */
+size_t
+refine(Query *q) {
+	Menu *m = q->m;
+	const unsigned int *matchbuf = m->matchbuf;
+	size_t k, j, n, end, ncand = m->ncand;
+
+	q->rejected = 0;
+	for(k = n = 0; k < ncand; k = j) {
+		for(j = k + 1; j < ncand && matchbuf[j] == matchbuf[j - 1] + 1; j++);
+		end = matchbuf[j - 1] + 1;
+		n = m->matchfn(q, matchbuf[k], end, n);
+	}
+	pthread_mutex_lock(&m->lock);
+	m->stats.scanned += ncand;
+	m->stats.rejected += q->rejected;
+	pthread_mutex_unlock(&m->lock);
+	return n;
+}
+
+/* compile the query as an extended regular expression, False if it is not
+ * one (yet) */
+Bool
+regbuild(Query *q, const char *s) {
+	char lit[sizeof q->text];
+	regex_t re;
+
+	/* back-references would need a backtracking matcher */
+	if(!relit(lit, s))
+		return False;
+	if(*s && regcomp(&re, s, REG_EXTENDED | REG_NOSUB | (q->m->foldcase ? REG_ICASE : 0)))
+		return False;
+	strcpy(q->text, lit);
+	if(q->hasre)
+		regfree(&q->re);
+	if((q->hasre = (*s != '\0')))
+		q->re = re;
+	if(q->m->foldcase)
+		fold(q->buf, q->text);
+	else
+		strcpy(q->buf, q->text);
+	q->sig = signature(q->buf);
+	q->tokc = 0;
+	q->nstates = 0;
+	return True;
+}
+
+/* store in d the longest run of bytes every match of the extended regular
+ * expression s contains, none if it has alternation at the top level.
+ * False if s uses back-references. */
+Bool
+relit(char *d, const char *s) {
+	char run[BUFSIZ], c;
+	size_t n = 0, best = 0;
+	int depth = 0;
+	Bool alt = False, zero;
+
+	for(*d = '\0'; ; s++) {
+		if(*s == '\\' && s[1] >= '1' && s[1] <= '9')
+			return False;
+		if(depth == 0 && *s == '\\' && s[1] && !isalnum((unsigned char)s[1]) && !strchr("<>`'", s[1])) {
+			run[n++] = *++s;
+			continue;
+		}
+		if(depth == 0 && *s && !strchr("\\()[.^$|*+?{", *s)) {
+			run[n++] = *s;
+			continue;
+		}
+		if(*s && strchr("*+?{", *s)) {
+			/* quantifiers in a row act as one, the rune before them is
+			 * optional if any of them allows zero */
+			for(zero = False; *s && strchr("*+?{", *s); s++) {
+				zero |= (*s != '+' && (*s != '{' || s[1] == '0' || s[1] == ','));
+				if(*s == '{')
+					for(; s[1] && *s != '}'; s++);
+			}
+			s--;
+			while(zero && n > 0 && (run[n-1] & 0xc0) == 0x80)
+				n--;
+			n -= (zero && n > 0);
+		}
+		if(n > best) {
+			memcpy(d, run, n);
+			d[best = n] = '\0';
+		}
+		n = 0;
+		switch(*s) {
+		case '\0':
+			if(alt)
+				*d = '\0';
+			return True;
+		case '\\':
+			s += (s[1] != '\0');
+			break;
+		case '|':
+			alt |= (depth == 0);
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			depth -= (depth > 0);
+			break;
+		case '[':
+			/* skip the bracket expression, a leading ] belongs to it */
+			s++;
+			s += (*s == '^');
+			s += (*s == ']');
+			for(; *s && *s != ']'; s++)
+				if(*s == '[' && s[1] && strchr(":.=", s[1])) {
+					for(c = s[1], s += 2; *s && !(*s == c && s[1] == ']'); s++);
+					s += (*s != '\0');
+				}
+			s -= (*s == '\0');
+			break;
+		}
+	}
+}
+
+/* run the matcher over items [i, end) and account for it */
+size_t
+scan(Query *q, size_t i, size_t end, size_t n) {
+	Menu *m = q->m;
+	struct timespec t0, t1;
+	unsigned long long ns;
+
+	q->rejected = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	n = m->matchfn(q, i, end, n);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pthread_mutex_lock(&m->lock);
+	m->stats.scanned += end - i;
+	m->stats.rejected += q->rejected;
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+	m->stats.ns += ns;
+	/* learn what an item costs for the planner, from scans long enough
+	 * to time */
+	if(end - i >= 256)
+		m->corpus.nsitem = m->corpus.nsitem ? (3 * m->corpus.nsitem + (double)ns / (end - i)) / 4
+		                 : (double)ns / (end - i);
+	pthread_mutex_unlock(&m->lock);
+	return n;
+}
+
+/* one bit per letter (either case), digit and common punctuation, non-ASCII
+ * bytes share three bits */
+void
+siginit(void) {
+	static const char punct[] = " ./-_:,@+=~#()[]'\"!?&%*;$";
+	const char *p;
+	int c;
+
+	for(c = 0; c < 26; c++)
+		sigbits['a' + c] = sigbits['A' + c] = (uint64_t)1 << c;
+	for(c = 0; c < 10; c++)
+		sigbits['0' + c] = (uint64_t)1 << (26 + c);
+	for(p = punct; *p; p++)
+		sigbits[(unsigned char)*p] = (uint64_t)1 << (36 + (p - punct));
+	for(c = 0x80; c < 256; c++)
+		sigbits[c] = (uint64_t)1 << (61 + c % 2);
+}
+
+/* 64-bit set of the character classes in s */
+uint64_t
+signature(const char *s) {
+	uint64_t sig;
+
+	for(sig = SIG_LIVE; *s; s++)
+		sig |= sigbits[(unsigned char)*s];
+	return sig;
+}
+
+/* stable counting sort of the first n candidates in matchbuf by tier; as
+ * candidates come in item order, those of the best tier are final */
+void
+sortmatches(Menu *m, size_t n, int ntiers) {
+	const unsigned int *matchbuf = m->matchbuf;
+	unsigned int *matches = m->matches, predicted = m->predicted;
+	size_t i, p = n, lo = 0, hi = n, start[256 * MENU_SOURCES];
+	int t;
+
+	/* the learned pick goes first if it is a candidate, they are in
+	 * item order */
+	while(predicted != UINT_MAX && lo < hi)
+		if(matchbuf[(lo + hi) / 2] < predicted)
+			lo = (lo + hi) / 2 + 1;
+		else
+			hi = (lo + hi) / 2;
+	if(predicted != UINT_MAX && lo < n && matchbuf[lo] == predicted)
+		p = lo;
+	ntiers *= MAX(m->nsrcs, 1);
+	memset(start, 0, ntiers * sizeof *start);
+	for(i = 0; i < n; i++)
+		start[SORTKEY(m, i)] += (i != p);
+	m->settled = start[0] + (p < n);
+	for(i = (p < n), t = 0; t < ntiers; t++) {
+		i += start[t];
+		start[t] = i - start[t];
+	}
+	for(i = 0; i < n; i++)
+		if(i != p)
+			matches[start[SORTKEY(m, i)]++] = matchbuf[i];
+	if(p < n)
+		matches[0] = predicted;
+	m->nmatches = n;
+}
+
+Bool
+termmatch(const Term *t, const char *s) {
+	const char *p;
+	size_t len;
+	Bool m;
+
+	switch(t->op) {
+	case TermPrefix:
+		m = !strncmp(s, t->s, t->len);
+		break;
+	case TermSuffix:
+		len = strlen(s);
+		m = len >= t->len && !strcmp(s + len - t->len, t->s);
+		break;
+	case TermWhole:
+		m = !strcmp(s, t->s);
+		break;
+	case TermFuzzy:
+		for(p = t->s; *p && (s = strchr(s, *p)); p++, s++);
+		m = !*p;
+		break;
+	default:
+		m = strstr(s, t->s) != NULL;
+		break;
+	}
+	return m != t->neg;
+}
+
+/* the handle of text of item i, in one of the latest segments if it lies
+ * close enough after its start, else in a new one that starts at text.  A
+ * run of items starts counting SEG_RECENT segments back, and each item opens
+ * at most two, for its text and its folded text. */
+uint32_t
+texthandle(Menu *m, size_t i, const char *text) {
+	uintptr_t p = (uintptr_t)text;
+	size_t s, base;
+
+	if(i / SEG_ITEMS >= m->nsegbase) {
+		if(!(m->segbase = realloc(m->segbase, (i / SEG_ITEMS + 1) * sizeof *m->segbase)))
+			die("cannot realloc %u bytes:", (i / SEG_ITEMS + 1) * sizeof *m->segbase);
+		for(; m->nsegbase <= i / SEG_ITEMS; m->nsegbase++)
+			m->segbase[m->nsegbase] = m->nsegs - MIN(m->nsegs, SEG_RECENT);
+	}
+	base = m->segbase[i / SEG_ITEMS];
+	for(s = m->nsegs; s-- > base && s + SEG_RECENT >= m->nsegs; )
+		if(p - m->segs[s] < (1 << SEG_SHIFT)) /* wraps if p is before it */
+			return (s - base) << SEG_SHIFT | (p - m->segs[s]);
+	if(m->nsegs == m->segsize) {
+		m->segsize = MAX(2 * m->segsize, 64);
+		if(!(m->segs = realloc(m->segs, m->segsize * sizeof *m->segs)))
+			die("cannot realloc %u bytes:", m->segsize * sizeof *m->segs);
+	}
+	m->segs[m->nsegs] = p;
+	return (m->nsegs++ - base) << SEG_SHIFT;
+}
+
+uint64_t
+texthash(const char *s) {
+	uint64_t h = 14695981039346656037ULL;
+
+	for(; *s; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	return h;
+}
+
+/* wait for the worker to let go of the items before they change */
+void
+workidle(Menu *m) {
+	if(m->wakefd[0] == -1)
+		return;
+	pthread_mutex_lock(&m->lock);
+	while(m->workbusy)
+		pthread_cond_wait(&m->donecond, &m->lock);
+	pthread_mutex_unlock(&m->lock);
+}
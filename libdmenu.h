@@ -0,0 +1,83 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * libdmenu matches and ranks a list of items the way dmenu does.  All of its
+ * state lives in a Menu, and menus share nothing, so different threads may
+ * each use menus of their own at the same time.  A menu is used from one
+ * thread only; it scans large lists on a thread it starts itself, whose
+ * results come in after menumatch() has returned.  libdmenu exits the
+ * program when it runs out of memory, as dmenu does. */
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#define LIBDMENU_VERSION 1
+#define MENU_SOURCES 8   /* item tags ranked apart, see menuadd() */
+
+typedef struct Menu Menu;  /* match context */
+
+enum { MenuSub, MenuTok, MenuFuzzy, MenuRegex, MenuApprox }; /* matchers */
+enum { MenuFold = 1, MenuExtended = 2 };                       /* options */
+
+/* a menu matching with matcher, options or'ed together; maxerr is the
+ * number of edits MenuApprox allows.  MenuExtended understands the query
+ * syntax of dmenu -e, with fuzzy plain terms if matcher is MenuFuzzy. */
+Menu *initmenu(int matcher, int options, int maxerr);
+void freemenu(Menu *m);
+
+/* bytes of item text kept on the heap before it is spilled to a file */
+void menubudget(Menu *m, size_t bytes);
+/* learn picks in file and list them first, 0 if it cannot be mapped.  A
+ * missing or empty file is made a learn file, any other that is not one is
+ * left alone and refused with EINVAL.  Call it before adding items. */
+int menulearn(Menu *m, const char *file);
+
+/* add an item of len bytes, a copy of text or text itself, which must then
+ * stay as it is, NUL included, until the menu is freed.  Within a rank the
+ * items of a lower src are listed first.  Item text is addressed with 32-bit
+ * handles relative to each run of items, so its size is bounded by memory
+ * alone, however far apart the texts given to menuaddref() lie. */
+void menuadd(Menu *m, const char *text, size_t len, int src);
+void menuaddref(Menu *m, const char *text, size_t len, int src);
+/* read one block of items separated by delim from fd, return what read()
+ * did; at end of file the last item needs no delimiter.  Blocks read for
+ * one src are kept together, so a src is best read by one fd at a time. */
+ssize_t menuread(Menu *m, int fd, int delim, int src);
+void menuremove(Menu *m, size_t item);
+/* items removed since the last menucompact() */
+size_t menudead(const Menu *m);
+/* drop the removed items for good, the others move down in order.  The
+ * result is brought up to date first, waiting for the scanning thread if it
+ * is still at it.  map, if not NULL, has room for menuitems() entries and is
+ * given the new index of each item, UINT_MAX for the removed ones. */
+void menucompact(Menu *m, unsigned int *map);
+/* apply the items added and removed since the last match to the result */
+void menuupdate(Menu *m);
+/* the scanning thread reads the items, adding or removing any waits */
+int menubusy(Menu *m);
+size_t menuitems(const Menu *m);
+const char *menuitem(const Menu *m, size_t item);
+const char *menulongest(const Menu *m);
+
+/* match s, settling at least want matches before returning; 0 if s is not
+ * a complete regular expression yet, which keeps the result.  pos holds two
+ * indices into the results the caller keeps, a selection say, which are
+ * stored with the result and given back if s is matched again. */
+int menumatch(Menu *m, const char *s, size_t want, size_t pos[2]);
+/* the result of the scanning thread is not taken up yet */
+int menupending(const Menu *m);
+/* readable when the scanning thread has news, -1 before it has started */
+int menufd(const Menu *m);
+/* take up what the scanning thread has found, 1 if the results changed.
+ * Only matches that were settled before stay where they were. */
+int menucollect(Menu *m);
+/* block until the scanning thread is done, menucollect() then finishes */
+void menuwait(Menu *m);
+/* the results in rank order, valid until the next call that changes them */
+const unsigned int *menuresults(const Menu *m);
+size_t menucount(const Menu *m);
+/* leading results no item still to be scanned can displace */
+size_t menusettled(const Menu *m);
+
+/* remember that item was picked after typing s */
+void menupick(Menu *m, const char *s, size_t item);
+void menustats(Menu *m, FILE *f);
@@ -0,0 +1,21 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Layout of the packed item list dmenu -packed maps in place: a header,
+ * count + 1 offsets from the start of the segment, the last of which is
+ * where the strings end, and the strings, each ended by a NUL just before
+ * the next one starts.  All integers are in host byte order. */
+
+#include <stdint.h>
+
+#define PACKED_MAGIC   0x6b706d64  /* "dmpk" */
+#define PACKED_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t count;  /* items */
+	uint64_t size;   /* bytes of the whole segment */
+} PackedHeader;
+
+#define PACKED_OFFSETS(h)  ((const uint64_t *)((const PackedHeader *)(h) + 1))
+#define PACKED_DATA(count) (sizeof (PackedHeader) + ((count) + 1) * sizeof (uint64_t))
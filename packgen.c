@@ -0,0 +1,77 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * packgen reads items from stdin like dmenu, packs them into a sealed memfd
+ * and runs dmenu on it with -packed; a sample producer for packed.h. */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "packed.h"
+
+static void die(const char *s);
+
+int
+main(int argc, char *argv[]) {
+	char *line = NULL, *text = NULL, *base, fdarg[16], **args;
+	size_t cap = 0, n = 0, nsize = 0, len = 0, size, i;
+	uint64_t *off = NULL, *o;
+	PackedHeader *h;
+	ssize_t k;
+	int fd;
+
+	/* in a real producer the items are already in memory */
+	while((k = getline(&line, &cap, stdin)) != -1) {
+		if(k > 0 && line[k - 1] == '\n')
+			line[--k] = '\0';
+		if(n == nsize && !(off = realloc(off, (nsize = nsize ? 2 * nsize : 1024) * sizeof *off)))
+			die("realloc");
+		if(!(text = realloc(text, len + k + 1)))
+			die("realloc");
+		memcpy(text + len, line, k + 1);
+		off[n++] = len;
+		len += k + 1;
+	}
+
+	size = PACKED_DATA(n) + len;
+	if((fd = memfd_create("dmenu-items", MFD_ALLOW_SEALING)) == -1)
+		die("memfd_create");
+	if(ftruncate(fd, size) == -1)
+		die("ftruncate");
+	if((base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		die("mmap");
+	h = (PackedHeader *)base;
+	h->magic = PACKED_MAGIC;
+	h->version = PACKED_VERSION;
+	h->count = n;
+	h->size = size;
+	o = (uint64_t *)PACKED_OFFSETS(h);
+	for(i = 0; i < n; i++)
+		o[i] = PACKED_DATA(n) + off[i];
+	o[n] = PACKED_DATA(n) + len;
+	memcpy(base + PACKED_DATA(n), text, len);
+	munmap(base, size);
+	/* dmenu trusts the layout it checked once, so it may not change */
+	if(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+		die("fcntl");
+
+	if(!(args = malloc((argc + 3) * sizeof *args)))
+		die("malloc");
+	snprintf(fdarg, sizeof fdarg, "%d", fd);
+	args[0] = "dmenu";
+	args[1] = "-packed";
+	args[2] = fdarg;
+	for(i = 1; i <= (size_t)argc; i++)
+		args[i + 2] = argv[i];
+	execvp("dmenu", args);
+	die("dmenu");
+	return EXIT_FAILURE;
+}
+
+void
+die(const char *s) {
+	perror(s);
+	exit(EXIT_FAILURE);
+}
@@ -5,15 +5,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/stat.h>
-
-#define FLAG(x)  (flag[(x)-'a'])
+#include "filetest.h"
 
 static void test(const char *, const char *);
 
 static bool match = false;
-static bool flag[26];
-static struct stat old, new;
+static FileTest t;
 
 int
 main(int argc, char *argv[]) {
@@ -26,11 +23,11 @@ main(int argc, char *argv[]) {
 		switch(opt) {
 		case 'n': /* newer than file */
 		case 'o': /* older than file */
-			if(!(FLAG(opt) = !stat(optarg, (opt == 'n' ? &new : &old))))
+			if(!(FLAG(&t, opt) = !stat(optarg, (opt == 'n' ? &t.new : &t.old))))
 				perror(optarg);
 			break;
 		default:  /* miscellaneous operators */
-			FLAG(opt) = true;
+			FLAG(&t, opt) = true;
 			break;
 		case '?': /* error: unknown flag */
 			fprintf(stderr, "usage: %s [-abcdefghlpqrsuwx] [-n file] [-o file] [file...]\n", argv[0]);
@@ -43,7 +40,7 @@ main(int argc, char *argv[]) {
 			test(buf, buf);
 		}
 	for(; optind < argc; optind++)
-		if(FLAG('l') && (dir = opendir(argv[optind]))) {
+		if(FLAG(&t, 'l') && (dir = opendir(argv[optind]))) {
 			/* test directory contents */
 			while((d = readdir(dir)))
 				if(snprintf(buf, sizeof buf, "%s/%s", argv[optind], d->d_name) < sizeof buf)
@@ -58,25 +55,8 @@ main(int argc, char *argv[]) {
 
 void
 test(const char *path, const char *name) {
-	struct stat st, ln;
-
-	if(!stat(path, &st) && (FLAG('a') || name[0] != '.')          /* hidden files      */
-	&& (!FLAG('b') || S_ISBLK(st.st_mode))                        /* block special     */
-	&& (!FLAG('c') || S_ISCHR(st.st_mode))                        /* character special */
-	&& (!FLAG('d') || S_ISDIR(st.st_mode))                        /* directory         */
-	&& (!FLAG('e') || access(path, F_OK) == 0)                    /* exists            */
-	&& (!FLAG('f') || S_ISREG(st.st_mode))                        /* regular file      */
-	&& (!FLAG('g') || st.st_mode & S_ISGID)                       /* set-group-id flag */
-	&& (!FLAG('h') || (!lstat(path, &ln) && S_ISLNK(ln.st_mode))) /* symbolic link     */
-	&& (!FLAG('n') || st.st_mtime > new.st_mtime)                 /* newer than file   */
-	&& (!FLAG('o') || st.st_mtime < old.st_mtime)                 /* older than file   */
-	&& (!FLAG('p') || S_ISFIFO(st.st_mode))                       /* named pipe        */
-	&& (!FLAG('r') || access(path, R_OK) == 0)                    /* readable          */
-	&& (!FLAG('s') || st.st_size > 0)                             /* not empty         */
-	&& (!FLAG('u') || st.st_mode & S_ISUID)                       /* set-user-id flag  */
-	&& (!FLAG('w') || access(path, W_OK) == 0)                    /* writable          */
-	&& (!FLAG('x') || access(path, X_OK) == 0)) {                 /* executable        */
-		if(FLAG('q'))
+	if(filetest(&t, path, name)) {
+		if(FLAG(&t, 'q'))
 			exit(0);
 		match = true;
 		puts(name);